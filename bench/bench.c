@@ -0,0 +1,51 @@
+/*
+ * bench.c
+ *
+ * Runs the microbenchmarks of the server data structures.
+ *
+ *  @since 2020-04-22
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/**
+ * Run the named benchmarks, or all of them.
+ *
+ * usage: bench [scheduler] [properties] [-n count]
+ *
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @return 0 if successful
+ */
+int main(int argc, char *argv[argc]) {
+	int count = 0;
+	bool all = true;
+	bool scheduler = false;
+	bool properties = false;
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+			count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "scheduler") == 0) {
+			scheduler = true;
+			all = false;
+		} else if (strcmp(argv[i], "properties") == 0) {
+			properties = true;
+			all = false;
+		} else {
+			fprintf(stderr, "usage: %s [scheduler] [properties] [-n count]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (all || scheduler) {
+		scheduler_bench((count > 0) ? count : 100000);
+	}
+	if (all || properties) {
+		properties_bench((count > 0) ? count : 1000000);
+	}
+	return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * bench.h
+ *
+ * Microbenchmarks of the server data structures.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+/**
+ * Compare the scheduler's lock-free rings with a mutex-protected
+ * linked-list queue, for 1 to 64 producers and consumers.
+ *
+ * @param njobs the number of jobs in each run
+ */
+void scheduler_bench(int njobs);
+
+/**
+ * Compare property lookups in the hash-indexed property list
+ * with a linear scan, at 4, 64 and 2,000 properties.
+ *
+ * @param nlookups the number of lookups at each size
+ */
+void properties_bench(int nlookups);
+
+#endif /* BENCH_H_ */
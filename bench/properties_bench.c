@@ -0,0 +1,108 @@
+/*
+ * properties_bench.c
+ *
+ * Compares looking up properties in the hash-indexed property
+ * list with the linear case-insensitive scan it replaced.
+ *
+ *  @since 2020-04-22
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "properties.h"
+#include "simd_util.h"
+#include "time_util.h"
+
+/** largest number of properties */
+#define MAX_PROPS 2000
+
+/** length of a property name */
+#define NAME_LEN 16
+
+/** an entry of the linear list */
+struct entry {
+	/** name of the entry */
+	char name[NAME_LEN];
+
+	/** value of the entry */
+	const char *val;
+};
+
+/** the linear list */
+static struct entry entries[MAX_PROPS];
+
+/** names that are looked up, in different case than stored */
+static char keys[MAX_PROPS][NAME_LEN];
+
+/** sum of looked-up values, so lookups are not optimized away */
+static volatile uintptr_t sink;
+
+/**
+ * Find a name in the linear list, as the property list did
+ * before it was indexed.
+ *
+ * @param nentries the number of entries
+ * @param name the name
+ * @return the value, or NULL if not found
+ */
+static const char *linear_find(size_t nentries, const char *name) {
+	size_t len = strlen(name);
+	for (size_t i = 0; i < nentries; i++) {
+		if ((strlen(entries[i].name) == len) && str_caseeq(entries[i].name, name, len)) {
+			return entries[i].val;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Time looking up every name of a list, and a missing name
+ * for each, in both the property list and the linear list.
+ *
+ * @param nprops the number of properties
+ * @param nlookups the number of lookups
+ */
+static void time_lookups(size_t nprops, int nlookups) {
+	Properties *props = newProperties();
+	for (size_t i = 0; i < nprops; i++) {
+		snprintf(entries[i].name, NAME_LEN, "X-Header-%zu", i);
+		entries[i].val = entries[i].name;
+		putProperty(props, entries[i].name, entries[i].name);
+		str_lower(keys[i], entries[i].name, NAME_LEN);
+	}
+
+	const char *missing = "x-missing";
+	double hashed[2], linear[2];
+	for (int hit = 1; hit >= 0; hit--) {
+		uint64_t begin = monotonicTimeNanos();
+		for (int i = 0; i < nlookups; i++) {
+			sink += (uintptr_t)findPropertyValue(props, hit ? keys[i % nprops] : missing);
+		}
+		hashed[hit] = (double)(monotonicTimeNanos() - begin) / nlookups;
+
+		begin = monotonicTimeNanos();
+		for (int i = 0; i < nlookups; i++) {
+			sink += (uintptr_t)linear_find(nprops, hit ? keys[i % nprops] : missing);
+		}
+		linear[hit] = (double)(monotonicTimeNanos() - begin) / nlookups;
+	}
+	printf("%7zu %9.1f %9.1f %9.1f %9.1f\n", nprops, hashed[1], linear[1], hashed[0], linear[0]);
+	deleteProperties(props);
+}
+
+/**
+ * Compare property lookups in the hash-indexed property list
+ * with a linear scan, at 4, 64 and 2,000 properties.
+ *
+ * @param nlookups the number of lookups at each size
+ */
+void properties_bench(int nlookups) {
+	printf("properties: ns per lookup for %d lookups\n", nlookups);
+	printf("%7s %9s %9s %9s %9s\n", "entries", "hash hit", "scan hit", "hash miss", "scan miss");
+	static const size_t sizes[] = { 4, 64, MAX_PROPS };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		time_lookups(sizes[i], nlookups);
+	}
+}
@@ -0,0 +1,247 @@
+/*
+ * scheduler_bench.c
+ *
+ * Compares handing work to the scheduler's lock-free rings with
+ * a mutex-protected linked-list queue that allocates a node for
+ * each job and signals a condition variable, as the thread pool
+ * did before the scheduler replaced it.
+ *
+ *  @since 2020-04-22
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "scheduler.h"
+#include "time_util.h"
+
+/** largest number of producers or consumers */
+#define MAX_THREADS 64
+
+/** number of jobs run in the current run */
+static unsigned long ndone;
+
+/**
+ * Job that counts that it was run.
+ *
+ * @param arg unused
+ */
+static void count_job(void *arg) {
+	(void)arg;
+	__atomic_add_fetch(&ndone, 1, __ATOMIC_RELAXED);
+}
+
+/** a job of the mutex queue */
+struct job {
+	/** the next job */
+	struct job *next;
+
+	/** the job function */
+	void (*function)(void *);
+
+	/** the argument to the job function */
+	void *arg;
+};
+
+/** mutex-protected linked-list queue of jobs */
+struct mutex_queue {
+	/** lock for the queue */
+	pthread_mutex_t lock;
+
+	/** condition that wakes waiting consumers */
+	pthread_cond_t cond;
+
+	/** the oldest job */
+	struct job *head;
+
+	/** the newest job */
+	struct job *tail;
+
+	/** true when consumers should exit once the queue is empty */
+	bool shutdown;
+};
+
+/**
+ * Add a job to the back of a mutex queue.
+ *
+ * @param queue the queue
+ * @param function the job function
+ * @param arg the argument to the job function
+ * @return 0 if successful, -1 if out of memory
+ */
+static int mutex_queue_add(struct mutex_queue *queue, void (*function)(void *), void *arg) {
+	struct job *job = malloc(sizeof(struct job));
+	if (job == NULL) {
+		return -1;
+	}
+	job->next = NULL;
+	job->function = function;
+	job->arg = arg;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->tail == NULL) {
+		queue->head = job;
+	} else {
+		queue->tail->next = job;
+	}
+	queue->tail = job;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
+
+/**
+ * Consumer thread that runs jobs from a mutex queue until it
+ * is shut down.
+ *
+ * @param arg the queue
+ * @return NULL
+ */
+static void *mutex_queue_consume(void *arg) {
+	struct mutex_queue *queue = arg;
+	while (true) {
+		pthread_mutex_lock(&queue->lock);
+		while (queue->head == NULL && !queue->shutdown) {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		}
+		struct job *job = queue->head;
+		if (job == NULL) {  // shut down and empty
+			pthread_mutex_unlock(&queue->lock);
+			break;
+		}
+		queue->head = job->next;
+		if (queue->head == NULL) {
+			queue->tail = NULL;
+		}
+		pthread_mutex_unlock(&queue->lock);
+
+		job->function(job->arg);
+		free(job);
+	}
+	return NULL;
+}
+
+/** a producer of one run */
+struct producer {
+	/** the scheduler, or NULL to use the mutex queue */
+	struct scheduler *sched;
+
+	/** the mutex queue */
+	struct mutex_queue *queue;
+
+	/** number of jobs to add */
+	int njobs;
+
+	/** barrier that starts the producers together */
+	pthread_barrier_t *start;
+};
+
+/**
+ * Producer thread that adds its jobs to the scheduler or to
+ * the mutex queue.
+ *
+ * @param arg the producer
+ * @return NULL
+ */
+static void *produce(void *arg) {
+	struct producer *producer = arg;
+	pthread_barrier_wait(producer->start);
+	for (int i = 0; i < producer->njobs; i++) {
+		if (producer->sched != NULL) {
+			// the rings are bounded: wait for consumers to make room
+			while (scheduler_add_work(producer->sched, count_job, NULL) != 0) {
+				sched_yield();
+			}
+		} else {
+			mutex_queue_add(producer->queue, count_job, NULL);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Time adding and running jobs with a number of producers
+ * and consumers.
+ *
+ * @param use_rings true to use the scheduler, false the mutex queue
+ * @param nproducers the number of producer threads
+ * @param nconsumers the number of consumer threads
+ * @param njobs the number of jobs
+ * @return nanoseconds per job
+ */
+static double time_run(bool use_rings, int nproducers, int nconsumers, int njobs) {
+	struct scheduler *sched = NULL;
+	struct mutex_queue queue = {
+		.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER
+	};
+	pthread_t consumers[MAX_THREADS];
+	if (use_rings) {
+		sched = scheduler_init(nconsumers);
+		if (sched == NULL) {
+			return -1;
+		}
+	} else {
+		for (int i = 0; i < nconsumers; i++) {
+			pthread_create(&consumers[i], NULL, mutex_queue_consume, &queue);
+		}
+	}
+
+	__atomic_store_n(&ndone, 0, __ATOMIC_RELAXED);
+	pthread_barrier_t start;
+	pthread_barrier_init(&start, NULL, nproducers + 1);
+	struct producer producers[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	for (int i = 0; i < nproducers; i++) {
+		producers[i] = (struct producer) {
+			.sched = sched, .queue = &queue, .start = &start,
+			.njobs = njobs / nproducers + (i < njobs % nproducers)
+		};
+		pthread_create(&threads[i], NULL, produce, &producers[i]);
+	}
+
+	// producers wait for this thread, so no job is added before the clock starts
+	uint64_t begin = monotonicTimeNanos();
+	pthread_barrier_wait(&start);
+	for (int i = 0; i < nproducers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	while (__atomic_load_n(&ndone, __ATOMIC_RELAXED) < (unsigned long)njobs) {
+		sched_yield();
+	}
+	uint64_t elapsed = monotonicTimeNanos() - begin;
+	pthread_barrier_destroy(&start);
+
+	if (use_rings) {
+		scheduler_destroy(sched);
+	} else {
+		pthread_mutex_lock(&queue.lock);
+		queue.shutdown = true;
+		pthread_cond_broadcast(&queue.cond);
+		pthread_mutex_unlock(&queue.lock);
+		for (int i = 0; i < nconsumers; i++) {
+			pthread_join(consumers[i], NULL);
+		}
+	}
+	return (double)elapsed / njobs;
+}
+
+/**
+ * Compare the scheduler's lock-free rings with a mutex-protected
+ * linked-list queue, for 1 to 64 producers and consumers.
+ *
+ * @param njobs the number of jobs in each run
+ */
+void scheduler_bench(int njobs) {
+	printf("scheduler: ns per job for %d jobs\n", njobs);
+	printf("%9s %9s %9s %9s\n", "producers", "consumers", "rings", "mutex");
+	for (int nproducers = 1; nproducers <= MAX_THREADS; nproducers *= 2) {
+		for (int nconsumers = 1; nconsumers <= MAX_THREADS; nconsumers *= 2) {
+			double rings = time_run(true, nproducers, nconsumers, njobs);
+			double mutex = time_run(false, nproducers, nconsumers, njobs);
+			printf("%9d %9d %9.1f %9.1f\n", nproducers, nconsumers, rings, mutex);
+		}
+	}
+}
@@ -0,0 +1,117 @@
+/*
+ * admission.c
+ *
+ * Adaptive admission control for the requests an event loop
+ * dispatches to its workers. The limit on requests in flight
+ * adapts to recent service latency by additive increase and
+ * multiplicative decrease (AIMD).
+ *
+ * Once per window, if the average latency of completed requests
+ * exceeded the target, the limit is cut by a constant factor.
+ * Otherwise, if the limit was reached during the window, it grows
+ * by one for each limit's worth of completions, so it probes for
+ * capacity only while demand is there.
+ *
+ *  @since 2020-04-22
+ */
+#include "admission.h"
+#include "time_util.h"
+
+/** length of a measurement window in nanoseconds */
+#define WINDOW_NS 100000000ULL
+
+/** factor applied to the limit when latency exceeds the target */
+#define BACKOFF 0.8
+
+/**
+ * Initialize an admission controller.
+ *
+ * @param adm the admission controller
+ * @param min_limit the lowest limit on requests in flight
+ * @param max_limit the highest limit on requests in flight
+ * @param initial_limit the initial limit on requests in flight
+ * @param target_ms the target average latency in milliseconds, or 0 to admit all
+ */
+void admission_init(struct admission *adm, unsigned min_limit, unsigned max_limit,
+		unsigned initial_limit, int target_ms) {
+	adm->min_limit = min_limit;
+	adm->max_limit = (max_limit > min_limit) ? max_limit : min_limit;
+	adm->limit = initial_limit;
+	if (adm->limit < adm->min_limit) {
+		adm->limit = adm->min_limit;
+	} else if (adm->limit > adm->max_limit) {
+		adm->limit = adm->max_limit;
+	}
+	adm->target_ns = (uint64_t)target_ms * 1000000ULL;
+	adm->window_start = monotonicTimeNanos();
+	adm->saturated = false;
+	adm->inflight = 0;
+	adm->ncompleted = 0;
+	adm->latency_sum = 0;
+}
+
+/**
+ * Admit a request if the number in flight is under the limit.
+ * Called by the event loop thread.
+ *
+ * @param adm the admission controller
+ * @param force true to admit the request regardless of the limit
+ * @return true if the request was admitted
+ */
+bool admission_acquire(struct admission *adm, bool force) {
+	unsigned inflight = __atomic_load_n(&adm->inflight, __ATOMIC_RELAXED);
+	if (inflight + 1 >= adm->limit) {
+		adm->saturated = true;
+		if (!force && adm->target_ns > 0 && inflight >= adm->limit) {
+			return false;
+		}
+	}
+	__atomic_add_fetch(&adm->inflight, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+/**
+ * Record the completion of an admitted request.
+ * Called by any thread.
+ *
+ * @param adm the admission controller
+ * @param latency_ns the latency of the request in nanoseconds
+ */
+void admission_release(struct admission *adm, uint64_t latency_ns) {
+	__atomic_add_fetch(&adm->latency_sum, latency_ns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&adm->ncompleted, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&adm->inflight, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Adapt the limit to the latency of requests completed in the
+ * last measurement window. Called by the event loop thread.
+ *
+ * @param adm the admission controller
+ * @param now_ns the current monotonic time in nanoseconds
+ */
+void admission_update(struct admission *adm, uint64_t now_ns) {
+	if (adm->target_ns == 0 || now_ns - adm->window_start < WINDOW_NS) {
+		return;
+	}
+	adm->window_start = now_ns;
+	uint64_t ncompleted = __atomic_exchange_n(&adm->ncompleted, 0, __ATOMIC_RELAXED);
+	uint64_t latency_sum = __atomic_exchange_n(&adm->latency_sum, 0, __ATOMIC_RELAXED);
+	bool saturated = adm->saturated;
+	adm->saturated = false;
+	if (ncompleted == 0) {
+		return;
+	}
+
+	if (latency_sum / ncompleted > adm->target_ns) {
+		adm->limit *= BACKOFF;
+		if (adm->limit < adm->min_limit) {
+			adm->limit = adm->min_limit;
+		}
+	} else if (saturated) {
+		adm->limit += ncompleted / adm->limit;
+		if (adm->limit > adm->max_limit) {
+			adm->limit = adm->max_limit;
+		}
+	}
+}
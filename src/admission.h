@@ -0,0 +1,85 @@
+/*
+ * admission.h
+ *
+ * Adaptive admission control for the requests an event loop
+ * dispatches to its workers. The limit on requests in flight
+ * adapts to recent service latency by additive increase and
+ * multiplicative decrease (AIMD).
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef ADMISSION_H_
+#define ADMISSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** admission controller state */
+struct admission {
+	/** the current limit on requests in flight; updated by the loop thread */
+	double limit;
+
+	/** the lowest and highest limit */
+	double min_limit, max_limit;
+
+	/** target average service latency in nanoseconds, or 0 to admit all */
+	uint64_t target_ns;
+
+	/** start of the current measurement window in nanoseconds */
+	uint64_t window_start;
+
+	/** true if the limit was reached in the current window */
+	bool saturated;
+
+	/** number of requests in flight; updated by loop and workers */
+	unsigned inflight;
+
+	/** requests completed in the current window; updated by workers */
+	uint64_t ncompleted;
+
+	/** total latency of requests completed in the current window */
+	uint64_t latency_sum;
+};
+
+/**
+ * Initialize an admission controller.
+ *
+ * @param adm the admission controller
+ * @param min_limit the lowest limit on requests in flight
+ * @param max_limit the highest limit on requests in flight
+ * @param initial_limit the initial limit on requests in flight
+ * @param target_ms the target average latency in milliseconds, or 0 to admit all
+ */
+void admission_init(struct admission *adm, unsigned min_limit, unsigned max_limit,
+		unsigned initial_limit, int target_ms);
+
+/**
+ * Admit a request if the number in flight is under the limit.
+ * Called by the event loop thread.
+ *
+ * @param adm the admission controller
+ * @param force true to admit the request regardless of the limit
+ * @return true if the request was admitted
+ */
+bool admission_acquire(struct admission *adm, bool force);
+
+/**
+ * Record the completion of an admitted request.
+ * Called by any thread.
+ *
+ * @param adm the admission controller
+ * @param latency_ns the latency of the request in nanoseconds
+ */
+void admission_release(struct admission *adm, uint64_t latency_ns);
+
+/**
+ * Adapt the limit to the latency of requests completed in the
+ * last measurement window. Called by the event loop thread.
+ *
+ * @param adm the admission controller
+ * @param now_ns the current monotonic time in nanoseconds
+ */
+void admission_update(struct admission *adm, uint64_t now_ns);
+
+#endif /* ADMISSION_H_ */
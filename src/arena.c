@@ -0,0 +1,107 @@
+/*
+ * arena.c
+ *
+ * Bump allocator for storage that lives as long as a request.
+ * Allocations are carved from chunks that are kept when the
+ * arena is reset, so once the chunks are large enough for the
+ * requests on a connection, requests make no heap allocations.
+ *
+ *  @since 2020-04-22
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/** alignment of allocations */
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+/**
+ * Initialize an empty arena.
+ *
+ * @param arena the arena
+ */
+void arena_init(struct arena *arena) {
+	arena->first = NULL;
+	arena->cur = NULL;
+	arena->used = 0;
+}
+
+/**
+ * Allocate storage from an arena, aligned for any type.
+ *
+ * @param arena the arena
+ * @param size the number of bytes
+ * @return the storage, or NULL if unavailable
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	while ((arena->cur == NULL) || (size > arena->cur->size - arena->used)) {
+		// move to the next kept chunk, or add one after the last
+		struct arena_chunk *next = (arena->cur == NULL) ? arena->first : arena->cur->next;
+		if (next == NULL) {
+			size_t chunkSize = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+			next = malloc(sizeof(struct arena_chunk) + chunkSize);
+			if (next == NULL) {
+				return NULL;
+			}
+			next->next = NULL;
+			next->size = chunkSize;
+			if (arena->cur == NULL) {
+				arena->first = next;
+			} else {
+				arena->cur->next = next;
+			}
+		}
+		arena->cur = next;
+		arena->used = 0;
+	}
+	void *p = arena->cur->data + arena->used;
+	arena->used += size;
+	return p;
+}
+
+/**
+ * Copy at most n bytes of a string to storage allocated from
+ * an arena, and terminate the copy.
+ *
+ * @param arena the arena
+ * @param s the string
+ * @param n the maximum number of bytes to copy
+ * @return the copy, or NULL if unavailable
+ */
+char *arena_strndup(struct arena *arena, const char *s, size_t n) {
+	size_t len = strnlen(s, n);
+	char *copy = arena_alloc(arena, len + 1);
+	if (copy != NULL) {
+		memcpy(copy, s, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+/**
+ * Release all storage allocated from an arena for reuse,
+ * keeping its chunks.
+ *
+ * @param arena the arena
+ */
+void arena_reset(struct arena *arena) {
+	arena->cur = arena->first;
+	arena->used = 0;
+}
+
+/**
+ * Free the chunks of an arena, leaving it empty.
+ *
+ * @param arena the arena
+ */
+void arena_destroy(struct arena *arena) {
+	struct arena_chunk *chunk = arena->first;
+	while (chunk != NULL) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena_init(arena);
+}
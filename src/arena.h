@@ -0,0 +1,86 @@
+/*
+ * arena.h
+ *
+ * Bump allocator for storage that lives as long as a request.
+ * Allocations are carved from chunks that are kept when the
+ * arena is reset, so once the chunks are large enough for the
+ * requests on a connection, requests make no heap allocations.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+/** size of a chunk unless an allocation needs a larger one */
+#define ARENA_CHUNK_SIZE 4096
+
+/** a chunk of arena storage */
+struct arena_chunk {
+	/** next chunk of the arena, or NULL if none */
+	struct arena_chunk *next;
+
+	/** number of bytes of storage */
+	size_t size;
+
+	/** the storage */
+	_Alignas(max_align_t) char data[];
+};
+
+/** an arena */
+struct arena {
+	/** first chunk, or NULL if none yet */
+	struct arena_chunk *first;
+
+	/** chunk being allocated from, or NULL if none yet */
+	struct arena_chunk *cur;
+
+	/** number of bytes allocated from the current chunk */
+	size_t used;
+};
+
+/**
+ * Initialize an empty arena.
+ *
+ * @param arena the arena
+ */
+void arena_init(struct arena *arena);
+
+/**
+ * Allocate storage from an arena, aligned for any type.
+ *
+ * @param arena the arena
+ * @param size the number of bytes
+ * @return the storage, or NULL if unavailable
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * Copy at most n bytes of a string to storage allocated from
+ * an arena, and terminate the copy.
+ *
+ * @param arena the arena
+ * @param s the string
+ * @param n the maximum number of bytes to copy
+ * @return the copy, or NULL if unavailable
+ */
+char *arena_strndup(struct arena *arena, const char *s, size_t n);
+
+/**
+ * Release all storage allocated from an arena for reuse,
+ * keeping its chunks.
+ *
+ * @param arena the arena
+ */
+void arena_reset(struct arena *arena);
+
+/**
+ * Free the chunks of an arena, leaving it empty.
+ *
+ * @param arena the arena
+ */
+void arena_destroy(struct arena *arena);
+
+#endif /* ARENA_H_ */
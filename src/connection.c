@@ -0,0 +1,731 @@
+/*
+ * connection.c
+ *
+ * Per-connection state shared by the event loop and the
+ * request handlers, including the socket receive buffer
+ * and the buffer of pending response bytes.
+ *
+ *  @since 2020-04-22
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "connection.h"
+#include "coroutine.h"
+#include "event_loop.h"
+#include "http_server.h"
+#include "time_util.h"
+
+/** connection being processed by the current thread */
+static __thread struct connection *current_conn;
+
+/** pipe the current thread splices request bodies through, or -1 if none */
+static __thread int splice_pipe[2] = { -1, -1 };
+
+/** buffer the current thread copies request bodies through if they cannot splice */
+static __thread char recv_file_buf[CONN_RECV_FILE_SIZE];
+
+/**
+ * Get the connection being processed by the calling thread.
+ *
+ * @return the connection or NULL if none
+ */
+struct connection *conn_current(void) {
+	return current_conn;
+}
+
+/**
+ * Set the connection being processed by the calling thread.
+ *
+ * @param conn the connection or NULL if none
+ */
+void conn_set_current(struct connection *conn) {
+	current_conn = conn;
+}
+
+/**
+ * Create a new connection for a client socket.
+ *
+ * @param fd the client socket
+ * @param loop the event loop that owns the socket
+ * @return the connection or NULL if unavailable
+ */
+struct connection *conn_new(int fd, struct event_loop *loop) {
+	struct connection *conn = malloc(sizeof(struct connection));
+	if (conn == NULL) {
+		return NULL;
+	}
+	conn->rbuf = malloc(CONN_RBUF_SIZE);
+	if (conn->rbuf == NULL) {
+		free(conn);
+		return NULL;
+	}
+	conn->rsize = CONN_RBUF_SIZE;
+	conn->fd = fd;
+	conn->loop = loop;
+	conn->eof = false;
+	conn->error = false;
+	conn->nrequests = 0;
+	conn->request_start = 0;
+	timer_init(&conn->timer, conn);
+	conn->next = NULL;
+	conn->co = NULL;
+	conn->worker = -1;
+	conn->wait_events = 0;
+	conn->rpos = 0;
+	conn->rlen = 0;
+	conn->wlen = 0;
+	http_parser_init(&conn->parser);
+	arena_init(&conn->arena);
+	return conn;
+}
+
+/**
+ * Delete a connection, closing its socket.
+ *
+ * @param conn the connection
+ */
+void conn_delete(struct connection *conn) {
+	close(conn->fd);
+	free(conn->rbuf);
+	arena_destroy(&conn->arena);
+	free(conn);
+}
+
+/**
+ * Wait until a non-blocking socket is ready after an operation
+ * on it failed with EAGAIN. A handler running in a coroutine
+ * yields its worker thread until the event loop sees that the
+ * socket is ready; otherwise the thread blocks in poll().
+ *
+ * @param conn the connection
+ * @param events POLLIN or POLLOUT
+ * @return 0 if ready, -1 with errno set if operation failed for another reason
+ */
+static int wait_ready(struct connection *conn, short events) {
+	if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		return -1;
+	}
+	if (conn->co != NULL) {
+		conn->wait_events = events;
+		coro_yield(event_loop_suspend, conn);
+		return 0;
+	}
+
+	// a blocked worker is bounded by the same deadlines as a suspended handler
+	uint64_t now = monotonicTimeNanos() / 1000000;
+	uint64_t deadline = conn->request_start + server.request_timeout * 1000ULL;
+	uint64_t timeout = server.body_timeout * 1000ULL;
+	if (deadline <= now) {
+		shutdown(conn->fd, SHUT_RDWR);
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	if (deadline - now < timeout) {
+		timeout = deadline - now;
+	}
+
+	struct pollfd pfd = { .fd = conn->fd, .events = events };
+	int nready;
+	while ((nready = poll(&pfd, 1, (int)timeout)) < 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+	if (nready == 0) {
+		shutdown(conn->fd, SHUT_RDWR);
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Receive available bytes from the socket into the receive buffer.
+ *
+ * @param conn the connection
+ * @param wait true to block until bytes are available
+ * @return number of bytes received, 0 at end of stream,
+ *   or -1 with errno set if error (EAGAIN if none available)
+ */
+ssize_t conn_fill(struct connection *conn, bool wait) {
+	size_t room = conn_rbuf_prepare(conn);
+	if (room == 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	// never block in recv(): waits go through wait_ready(), which
+	// yields a coroutine or polls against the request deadlines
+	ssize_t nread;
+	do {
+		nread = recv(conn->fd, conn->rbuf + conn->rlen, room, MSG_DONTWAIT);
+	} while ((nread < 0) && ((errno == EINTR) || (wait && wait_ready(conn, POLLIN) == 0)));
+
+	conn_rbuf_commit(conn, nread);
+	return nread;
+}
+
+/**
+ * Make room at the end of the receive buffer for more bytes,
+ * which are to be received at conn->rbuf + conn->rlen. The
+ * buffer grows up to CONN_RBUF_MAX if a request does not fit.
+ *
+ * @param conn the connection
+ * @return number of bytes of room available
+ */
+size_t conn_rbuf_prepare(struct connection *conn) {
+	// parser offsets are relative to rpos, so they survive moving the bytes
+	if (conn->rpos == conn->rlen) {  // buffer drained: start over
+		conn->rpos = conn->rlen = 0;
+		if (conn->rsize > CONN_RBUF_SIZE) {  // shrink after a long request
+			char *rbuf = realloc(conn->rbuf, CONN_RBUF_SIZE);
+			if (rbuf != NULL) {
+				conn->rbuf = rbuf;
+				conn->rsize = CONN_RBUF_SIZE;
+			}
+		}
+	} else if (conn->rlen == conn->rsize && conn->rpos > 0) {  // compact
+		memmove(conn->rbuf, conn->rbuf + conn->rpos, conn->rlen - conn->rpos);
+		conn->rlen -= conn->rpos;
+		conn->rpos = 0;
+	} else if (conn->rlen == conn->rsize && conn->rsize < CONN_RBUF_MAX) {  // grow
+		char *rbuf = realloc(conn->rbuf, 2 * conn->rsize);
+		if (rbuf != NULL) {
+			conn->rbuf = rbuf;
+			conn->rsize *= 2;
+		}
+	}
+	return conn->rsize - conn->rlen;
+}
+
+/**
+ * Record the result of receiving bytes into the room made
+ * by conn_rbuf_prepare().
+ *
+ * @param conn the connection
+ * @param nread number of bytes received, 0 at end of stream,
+ *   or negative if error
+ */
+void conn_rbuf_commit(struct connection *conn, ssize_t nread) {
+	if (nread > 0) {
+		conn->rlen += nread;
+	} else if (nread == 0) {
+		conn->eof = true;
+	}
+}
+
+/**
+ * Determines whether the receive buffer holds a complete
+ * request line and headers, or a malformed request. Parses
+ * the request, resuming where the previous call left off.
+ *
+ * @param conn the connection
+ * @return true if the request is complete or malformed
+ */
+bool conn_request_ready(struct connection *conn) {
+	return http_parse(&conn->parser, conn->rbuf + conn->rpos, conn->rlen - conn->rpos)
+			!= HTTP_PARSE_INCOMPLETE;
+}
+
+/**
+ * Parse the request line and headers, receiving more bytes
+ * from the socket until they are complete. Pending responses
+ * are sent before waiting for the socket.
+ *
+ * @param conn the connection
+ * @return the parse status; HTTP_PARSE_INCOMPLETE if the peer
+ *   closed the connection or an error occurred
+ */
+enum http_parse_status conn_read_request(struct connection *conn) {
+	enum http_parse_status status;
+	while ((status = http_parse(&conn->parser, conn->rbuf + conn->rpos, conn->rlen - conn->rpos))
+			== HTTP_PARSE_INCOMPLETE) {
+		if (conn_rbuf_full(conn)) {
+			return HTTP_PARSE_TOO_LARGE;
+		}
+		// client may wait for pending responses before sending more
+		if (conn->eof || (conn_flush(conn) != 0) || (conn_fill(conn, true) <= 0)) {
+			break;
+		}
+	}
+	return status;
+}
+
+/**
+ * Consume the parsed request line and headers from the
+ * receive buffer, and reset the parser for the next request.
+ * Slices of the request are valid until the handler reads
+ * from the connection.
+ *
+ * @param conn the connection
+ */
+void conn_request_consume(struct connection *conn) {
+	conn->rpos += conn->parser.pos;
+	http_parser_init(&conn->parser);
+}
+
+/**
+ * Returns true if the receive buffer has no room for more bytes
+ * and cannot grow.
+ *
+ * @param conn the connection
+ * @return true if receive buffer is full
+ */
+bool conn_rbuf_full(const struct connection *conn) {
+	return (conn->rpos == 0) && (conn->rlen == CONN_RBUF_MAX);
+}
+
+/**
+ * Read request body bytes from the receive buffer, refilling it
+ * from the socket when it is empty. Pending responses are sent
+ * before waiting for the socket.
+ *
+ * @param conn the connection
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @return number of bytes read, 0 at end of stream, or -1 with
+ *   errno set if error
+ */
+ssize_t conn_read(struct connection *conn, void *buf, size_t size) {
+	if (conn->rpos == conn->rlen) {
+		if (conn->eof) {
+			return 0;
+		}
+		// client may wait for pending responses before sending more
+		if (conn_flush(conn) != 0) {
+			return -1;
+		}
+		ssize_t nread = conn_fill(conn, true);
+		if (nread <= 0) {
+			if (nread < 0) {
+				conn->error = true;
+			}
+			return nread;
+		}
+	}
+	size_t navail = conn->rlen - conn->rpos;
+	size_t ncopy = (size < navail) ? size : navail;
+	memcpy(buf, conn->rbuf + conn->rpos, ncopy);
+	conn->rpos += ncopy;
+	return ncopy;
+}
+
+/**
+ * Write all bytes of an I/O vector to the socket.
+ *
+ * @param conn the connection
+ * @param iov the I/O vector; entries are updated as bytes are written
+ * @param iovcnt the number of entries
+ * @param flags flags to send with, such as MSG_MORE
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int send_all(struct connection *conn, struct iovec *iov, int iovcnt, int flags) {
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+	// like recv(), never block, so waits are bounded by the deadlines
+	flags |= MSG_NOSIGNAL | MSG_DONTWAIT;
+	while (msg.msg_iovlen > 0) {
+		ssize_t n = sendmsg(conn->fd, &msg, flags);
+		if (n < 0) {
+			if ((errno == EINTR) || (wait_ready(conn, POLLOUT) == 0)) {
+				continue;
+			}
+			conn->error = true;
+			return -1;
+		}
+		// skip entries that were written completely
+		while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+			n -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen > 0) {
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+			msg.msg_iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Send the buffered response bytes to the socket.
+ *
+ * @param conn the connection
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_flush(struct connection *conn) {
+	if (conn->wlen == 0) {
+		return 0;
+	}
+	struct iovec iov = { .iov_base = conn->wbuf, .iov_len = conn->wlen };
+	conn->wlen = 0;
+	return send_all(conn, &iov, 1, 0);
+}
+
+/**
+ * Append response bytes to the response buffer. Responses to
+ * pipelined requests accumulate in the buffer until it fills
+ * or conn_flush() is called; then the buffered bytes and the
+ * new bytes are sent together with one vectored write.
+ *
+ * @param conn the connection
+ * @param iov the response bytes; entries may be updated
+ * @param iovcnt the number of entries, at most CONN_MAX_IOV
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_writev(struct connection *conn, struct iovec *iov, int iovcnt) {
+	if (conn->error) {
+		errno = EPIPE;
+		return -1;
+	}
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		size += iov[i].iov_len;
+	}
+	if (conn->wlen + size <= CONN_WBUF_SIZE) {
+		for (int i = 0; i < iovcnt; i++) {
+			memcpy(conn->wbuf + conn->wlen, iov[i].iov_base, iov[i].iov_len);
+			conn->wlen += iov[i].iov_len;
+		}
+		return 0;
+	}
+
+	struct iovec all[CONN_MAX_IOV + 1];
+	all[0].iov_base = conn->wbuf;
+	all[0].iov_len = conn->wlen;
+	memcpy(all + 1, iov, iovcnt * sizeof(struct iovec));
+	conn->wlen = 0;
+	return send_all(conn, all, iovcnt + 1, 0);
+}
+
+/**
+ * Append response bytes to the response buffer. If they do not
+ * fit, the buffered bytes and the new bytes are sent together
+ * with one vectored write.
+ *
+ * @param conn the connection
+ * @param buf the bytes to write
+ * @param size the number of bytes to write
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_write(struct connection *conn, const void *buf, size_t size) {
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = size };
+	return conn_writev(conn, &iov, 1);
+}
+
+/**
+ * Append formatted response bytes to the response buffer.
+ *
+ * @param conn the connection
+ * @param fmt the format
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_printf(struct connection *conn, const char *fmt, ...) {
+	if (conn->error) {
+		errno = EPIPE;
+		return -1;
+	}
+	va_list args;
+	va_start(args, fmt);
+	size_t room = CONN_WBUF_SIZE - conn->wlen;
+	int len = vsnprintf(conn->wbuf + conn->wlen, room, fmt, args);
+	va_end(args);
+	if (len < 0) {
+		return -1;
+	}
+	if ((size_t)len >= room) {  // send buffered bytes and format again
+		if (len >= CONN_WBUF_SIZE) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		if (conn_flush(conn) != 0) {
+			return -1;
+		}
+		va_start(args, fmt);
+		vsnprintf(conn->wbuf, CONN_WBUF_SIZE, fmt, args);
+		va_end(args);
+	}
+	conn->wlen += len;
+	return 0;
+}
+
+/**
+ * Write all bytes of a buffer to a file.
+ *
+ * @param fd the file descriptor
+ * @param buf the bytes to write
+ * @param size the number of bytes to write
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int write_all(int fd, const char *buf, size_t size) {
+	while (size > 0) {
+		ssize_t nwritten = write(fd, buf, size);
+		if (nwritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += nwritten;
+		size -= nwritten;
+	}
+	return 0;
+}
+
+/**
+ * Receive request body bytes from the socket into a buffer and
+ * write them to a file, for sockets and files that cannot splice.
+ *
+ * @param conn the connection
+ * @param fd the file descriptor
+ * @param nbytes the number of body bytes
+ * @return 0 if successful, -1 with errno set if error or the
+ *   peer closed the connection first
+ */
+static int recv_file(struct connection *conn, int fd, uint64_t nbytes) {
+	while (nbytes > 0) {
+		size_t n = (nbytes < CONN_RECV_FILE_SIZE) ? nbytes : CONN_RECV_FILE_SIZE;
+		ssize_t nread = recv(conn->fd, recv_file_buf, n, MSG_DONTWAIT);
+		if (nread < 0) {
+			if ((errno == EINTR) || (wait_ready(conn, POLLIN) == 0)) {
+				continue;
+			}
+			conn->error = true;
+			return -1;
+		}
+		if (nread == 0) {
+			conn->eof = true;
+			errno = EPIPE;
+			return -1;
+		}
+		// buffer is written before waiting, so other handlers on the thread can use it
+		if (write_all(fd, recv_file_buf, nread) != 0) {
+			return -1;
+		}
+		nbytes -= nread;
+	}
+	return 0;
+}
+
+/**
+ * Get the pipe the calling thread splices request bodies through.
+ *
+ * @return the pipe, or NULL if unavailable
+ */
+static int *get_splice_pipe(void) {
+	if (splice_pipe[0] < 0) {
+		if (pipe2(splice_pipe, O_CLOEXEC) != 0) {
+			return NULL;
+		}
+		// fewer, larger splices; the default size is used if not permitted
+		fcntl(splice_pipe[1], F_SETPIPE_SZ, CONN_SPLICE_PIPE_SIZE);
+	}
+	return splice_pipe;
+}
+
+/**
+ * Close the pipe of the calling thread after an error left
+ * bytes in it.
+ */
+static void close_splice_pipe(void) {
+	close(splice_pipe[0]);
+	close(splice_pipe[1]);
+	splice_pipe[0] = splice_pipe[1] = -1;
+}
+
+/**
+ * Move request body bytes from the socket to a file through a
+ * pipe with splice(), without copying them to user space. The
+ * pipe is emptied before waiting for the socket, so the other
+ * handlers on the thread can use it.
+ *
+ * @param conn the connection
+ * @param fd the file descriptor
+ * @param nbytes the number of body bytes; updated as they are written
+ * @return 0 if successful, -1 with errno set if error or the
+ *   peer closed the connection first; EINVAL or ENOSYS if the
+ *   socket or file cannot splice
+ */
+static int splice_file(struct connection *conn, int fd, uint64_t *nbytes) {
+	int *pipefd = get_splice_pipe();
+	if (pipefd == NULL) {
+		errno = ENOSYS;
+		return -1;
+	}
+	while (*nbytes > 0) {
+		size_t n = (*nbytes < CONN_SPLICE_PIPE_SIZE) ? *nbytes : CONN_SPLICE_PIPE_SIZE;
+		ssize_t nin = splice(conn->fd, NULL, pipefd[1], NULL, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (nin < 0) {
+			if ((errno == EINTR) || (wait_ready(conn, POLLIN) == 0)) {
+				continue;
+			}
+			if ((errno != EINVAL) && (errno != ENOSYS)) {
+				conn->error = true;
+			}
+			return -1;
+		}
+		if (nin == 0) {
+			conn->eof = true;
+			errno = EPIPE;
+			return -1;
+		}
+		while (nin > 0) {
+			ssize_t nout = splice(pipefd[0], NULL, fd, NULL, nin, SPLICE_F_MOVE);
+			if (nout < 0 && errno == EINTR) {
+				continue;
+			}
+			if (nout < 0 && ((errno == EINVAL) || (errno == ENOSYS))) {
+				// file cannot splice: copy what the pipe holds
+				size_t m = (nin < CONN_RECV_FILE_SIZE) ? nin : CONN_RECV_FILE_SIZE;
+				nout = read(pipefd[0], recv_file_buf, m);
+				if ((nout > 0) && (write_all(fd, recv_file_buf, nout) != 0)) {
+					nout = -1;
+				}
+			}
+			if (nout <= 0) {
+				close_splice_pipe();
+				return -1;
+			}
+			nin -= nout;
+			*nbytes -= nout;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Write request body bytes to a file, taking them from the
+ * receive buffer before receiving them from the socket. Bytes
+ * from the socket are moved with splice() if possible, and
+ * otherwise received into a large buffer.
+ *
+ * @param conn the connection
+ * @param fd the file descriptor
+ * @param nbytes the number of body bytes
+ * @return 0 if successful, -1 with errno set if error or the
+ *   peer closed the connection first
+ */
+int conn_recv_file(struct connection *conn, int fd, uint64_t nbytes) {
+	// body bytes received with the request head
+	size_t navail = conn->rlen - conn->rpos;
+	size_t n = (nbytes < navail) ? nbytes : navail;
+	if (write_all(fd, conn->rbuf + conn->rpos, n) != 0) {
+		return -1;
+	}
+	conn->rpos += n;
+	nbytes -= n;
+	if (nbytes == 0) {
+		return 0;
+	}
+	if (conn->eof) {
+		errno = EPIPE;
+		return -1;
+	}
+
+	// client may wait for pending responses before sending more
+	if (conn_flush(conn) != 0) {
+		return -1;
+	}
+	if ((splice_file(conn, fd, &nbytes) != 0)
+		&& ((errno == EINVAL) || (errno == ENOSYS))) {
+		return recv_file(conn, fd, nbytes);
+	}
+	return (nbytes == 0) ? 0 : -1;
+}
+
+/**
+ * Read bytes of a file into the response buffer, sending the
+ * buffer whenever it fills.
+ *
+ * @param conn the connection
+ * @param fd the file descriptor, positioned at the bytes to send
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error or the
+ *   file is shorter than expected
+ */
+static int copy_file(struct connection *conn, int fd, uint64_t nbytes) {
+	while (nbytes > 0) {
+		if ((conn->wlen == CONN_WBUF_SIZE) && (conn_flush(conn) != 0)) {
+			return -1;
+		}
+		size_t room = CONN_WBUF_SIZE - conn->wlen;
+		size_t n = (nbytes < room) ? nbytes : room;
+		ssize_t nread = read(fd, conn->wbuf + conn->wlen, n);
+		if (nread <= 0) {
+			if ((nread < 0) && (errno == EINTR)) {
+				continue;
+			}
+			if (nread == 0) {
+				errno = EIO;
+			}
+			return -1;
+		}
+		conn->wlen += nread;
+		nbytes -= nread;
+	}
+	return 0;
+}
+
+/**
+ * Send bytes of a file after the buffered response bytes. A file
+ * that fits in the response buffer is read into it, so it is sent
+ * with the response head and any other pipelined responses. A
+ * larger file is sent with sendfile() after the buffered bytes,
+ * which are sent with MSG_MORE so the head and the start of the
+ * file share packets. Files that sendfile() cannot send are read
+ * into the response buffer instead.
+ *
+ * @param conn the connection
+ * @param fd the file descriptor, positioned at the bytes to send
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error or the
+ *   file is shorter than expected
+ */
+int conn_send_file(struct connection *conn, int fd, uint64_t nbytes) {
+	if (conn->error) {
+		errno = EPIPE;
+		return -1;
+	}
+	if (nbytes <= CONN_WBUF_SIZE - conn->wlen) {
+		return copy_file(conn, fd, nbytes);
+	}
+
+	if (conn->wlen > 0) {
+		struct iovec iov = { .iov_base = conn->wbuf, .iov_len = conn->wlen };
+		conn->wlen = 0;
+		if (send_all(conn, &iov, 1, MSG_MORE) != 0) {
+			return -1;
+		}
+	}
+	while (nbytes > 0) {
+		// sendfile() sends at most this many bytes per call
+		size_t n = (nbytes < 0x7ffff000) ? nbytes : 0x7ffff000;
+		ssize_t nsent = sendfile(conn->fd, fd, NULL, n);
+		if (nsent < 0) {
+			if ((errno == EINTR) || (wait_ready(conn, POLLOUT) == 0)) {
+				continue;
+			}
+			if ((errno == EINVAL) || (errno == ENOSYS)) {
+				return copy_file(conn, fd, nbytes);
+			}
+			conn->error = true;
+			return -1;
+		}
+		if (nsent == 0) {  // file changed size
+			errno = EIO;
+			return -1;
+		}
+		nbytes -= nsent;
+	}
+	return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * connection.h
+ *
+ * Per-connection state shared by the event loop and the
+ * request handlers, including the socket receive buffer
+ * and the buffer of pending response bytes.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef CONNECTION_H_
+#define CONNECTION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "arena.h"
+#include "http_parser.h"
+#include "timer_wheel.h"
+
+/** initial size of the per-connection receive buffer */
+#define CONN_RBUF_SIZE 8192
+
+/** size the receive buffer may grow to for a long request line and headers */
+#define CONN_RBUF_MAX 65536
+
+/** size of the per-connection response buffer */
+#define CONN_WBUF_SIZE 16384
+
+/** maximum number of entries in an I/O vector passed to conn_writev() */
+#define CONN_MAX_IOV 8
+
+/** size of the pipe request bodies are spliced through */
+#define CONN_SPLICE_PIPE_SIZE (1024 * 1024)
+
+/** size of the buffer request bodies are copied through if they cannot splice */
+#define CONN_RECV_FILE_SIZE 65536
+
+struct event_loop;
+struct coroutine;
+
+/** state of a client connection */
+struct connection {
+	/** the client socket descriptor */
+	int fd;
+
+	/** the event loop that owns the socket */
+	struct event_loop *loop;
+
+	/** true if peer has closed its side of the connection */
+	bool eof;
+
+	/** true if sending or receiving on the socket failed */
+	bool error;
+
+	/** number of requests received on the connection */
+	unsigned nrequests;
+
+	/** monotonic time in milliseconds when the current request began, or 0 if none */
+	uint64_t request_start;
+
+	/** deadline while the event loop waits on the connection */
+	struct timer timer;
+
+	/** link in the event loop list of resumed connections */
+	struct connection *next;
+
+	/** coroutine running the request handler, or NULL if none */
+	struct coroutine *co;
+
+	/** worker that created the coroutine and must resume it */
+	int worker;
+
+	/** socket events the suspended handler is waiting for */
+	short wait_events;
+
+	/** monotonic time in nanoseconds when dispatched to a worker */
+	uint64_t dispatched;
+
+	/** offset of first unconsumed byte in rbuf */
+	size_t rpos;
+
+	/** number of bytes in rbuf */
+	size_t rlen;
+
+	/** size of rbuf */
+	size_t rsize;
+
+	/** number of response bytes in wbuf not yet sent */
+	size_t wlen;
+
+	/** parser of the request at rpos */
+	struct http_parser parser;
+
+	/** method and recognized headers of the request being processed */
+	struct http_request request;
+
+	/** storage for the request being processed, reset between requests */
+	struct arena arena;
+
+	/** receive buffer */
+	char *rbuf;
+
+	/** response buffer */
+	char wbuf[CONN_WBUF_SIZE];
+};
+
+/**
+ * Create a new connection for a client socket.
+ *
+ * @param fd the client socket
+ * @param loop the event loop that owns the socket
+ * @return the connection or NULL if unavailable
+ */
+struct connection *conn_new(int fd, struct event_loop *loop);
+
+/**
+ * Delete a connection, closing its socket.
+ *
+ * @param conn the connection
+ */
+void conn_delete(struct connection *conn);
+
+/**
+ * Receive available bytes from the socket into the receive buffer.
+ *
+ * @param conn the connection
+ * @param wait true to block until bytes are available
+ * @return number of bytes received, 0 at end of stream,
+ *   or -1 with errno set if error (EAGAIN if none available)
+ */
+ssize_t conn_fill(struct connection *conn, bool wait);
+
+/**
+ * Make room at the end of the receive buffer for more bytes,
+ * which are to be received at conn->rbuf + conn->rlen. The
+ * buffer grows up to CONN_RBUF_MAX if a request does not fit.
+ *
+ * @param conn the connection
+ * @return number of bytes of room available
+ */
+size_t conn_rbuf_prepare(struct connection *conn);
+
+/**
+ * Record the result of receiving bytes into the room made
+ * by conn_rbuf_prepare().
+ *
+ * @param conn the connection
+ * @param nread number of bytes received, 0 at end of stream,
+ *   or negative if error
+ */
+void conn_rbuf_commit(struct connection *conn, ssize_t nread);
+
+/**
+ * Determines whether the receive buffer holds a complete
+ * request line and headers, or a malformed request. Parses
+ * the request, resuming where the previous call left off.
+ *
+ * @param conn the connection
+ * @return true if the request is complete or malformed
+ */
+bool conn_request_ready(struct connection *conn);
+
+/**
+ * Parse the request line and headers, receiving more bytes
+ * from the socket until they are complete. Pending responses
+ * are sent before waiting for the socket.
+ *
+ * @param conn the connection
+ * @return the parse status; HTTP_PARSE_INCOMPLETE if the peer
+ *   closed the connection or an error occurred
+ */
+enum http_parse_status conn_read_request(struct connection *conn);
+
+/**
+ * Consume the parsed request line and headers from the
+ * receive buffer, and reset the parser for the next request.
+ * Slices of the request are valid until the handler reads
+ * from the connection.
+ *
+ * @param conn the connection
+ */
+void conn_request_consume(struct connection *conn);
+
+/**
+ * Returns true if the receive buffer has no room for more bytes
+ * and cannot grow.
+ *
+ * @param conn the connection
+ * @return true if receive buffer is full
+ */
+bool conn_rbuf_full(const struct connection *conn);
+
+/**
+ * Send the buffered response bytes to the socket.
+ *
+ * @param conn the connection
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_flush(struct connection *conn);
+
+/**
+ * Read request body bytes from the receive buffer, refilling it
+ * from the socket when it is empty. Pending responses are sent
+ * before waiting for the socket.
+ *
+ * @param conn the connection
+ * @param buf the buffer
+ * @param size the size of the buffer
+ * @return number of bytes read, 0 at end of stream, or -1 with
+ *   errno set if error
+ */
+ssize_t conn_read(struct connection *conn, void *buf, size_t size);
+
+/**
+ * Append response bytes to the response buffer. Responses to
+ * pipelined requests accumulate in the buffer until it fills
+ * or conn_flush() is called; then the buffered bytes and the
+ * new bytes are sent together with one vectored write.
+ *
+ * @param conn the connection
+ * @param iov the response bytes; entries may be updated
+ * @param iovcnt the number of entries, at most CONN_MAX_IOV
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_writev(struct connection *conn, struct iovec *iov, int iovcnt);
+
+/**
+ * Append response bytes to the response buffer. If they do not
+ * fit, the buffered bytes and the new bytes are sent together
+ * with one vectored write.
+ *
+ * @param conn the connection
+ * @param buf the bytes to write
+ * @param size the number of bytes to write
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_write(struct connection *conn, const void *buf, size_t size);
+
+/**
+ * Append formatted response bytes to the response buffer.
+ *
+ * @param conn the connection
+ * @param fmt the format
+ * @return 0 if successful, -1 with errno set if error
+ */
+int conn_printf(struct connection *conn, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/**
+ * Write request body bytes to a file, taking them from the
+ * receive buffer before receiving them from the socket. Bytes
+ * from the socket are moved with splice() if possible, and
+ * otherwise received into a large buffer.
+ *
+ * @param conn the connection
+ * @param fd the file descriptor
+ * @param nbytes the number of body bytes
+ * @return 0 if successful, -1 with errno set if error or the
+ *   peer closed the connection first
+ */
+int conn_recv_file(struct connection *conn, int fd, uint64_t nbytes);
+
+/**
+ * Send bytes of a file after the buffered response bytes. A file
+ * that fits in the response buffer is read into it, so it is sent
+ * with the response head and any other pipelined responses. A
+ * larger file is sent with sendfile() after the buffered bytes,
+ * which are sent with MSG_MORE so the head and the start of the
+ * file share packets. Files that sendfile() cannot send are read
+ * into the response buffer instead.
+ *
+ * @param conn the connection
+ * @param fd the file descriptor, positioned at the bytes to send
+ * @param nbytes the number of bytes to send
+ * @return 0 if successful, -1 with errno set if error or the
+ *   file is shorter than expected
+ */
+int conn_send_file(struct connection *conn, int fd, uint64_t nbytes);
+
+/**
+ * Get the connection being processed by the calling thread.
+ *
+ * @return the connection or NULL if none
+ */
+struct connection *conn_current(void);
+
+/**
+ * Set the connection being processed by the calling thread.
+ *
+ * @param conn the connection or NULL if none
+ */
+void conn_set_current(struct connection *conn);
+
+#endif /* CONNECTION_H_ */
@@ -0,0 +1,217 @@
+/*
+ * coroutine.c
+ *
+ * Stackful coroutines with pooled stacks, used to run request
+ * handlers that can yield their worker thread while waiting
+ * for a socket instead of blocking it.
+ *
+ * Stacks are mapped with a guard page below them, and are kept
+ * in a per-thread cache for reuse when a coroutine finishes.
+ * Each coroutine is stored at the top of its own stack, so
+ * creating one with a cached stack does not allocate.
+ *
+ *  @since 2020-04-22
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "coroutine.h"
+
+/**
+ * Size of a coroutine stack. Handlers keep several large buffers
+ * on the stack (e.g. directory listings), so this is generous;
+ * pages that are not touched are never allocated.
+ */
+#define CORO_STACK_SIZE (512 * 1024)
+
+/** maximum number of stacks cached by each thread */
+#define CORO_STACK_CACHE 64
+
+/** a coroutine */
+struct coroutine {
+	/** the coroutine context */
+	ucontext_t ctx;
+
+	/** the context of the thread that resumed the coroutine */
+	ucontext_t *caller;
+
+	/** the coroutine stack, above its guard page */
+	void *stack;
+
+	/** the coroutine function */
+	void (*function)(void *);
+
+	/** the argument to the coroutine function */
+	void *arg;
+
+	/** function called after the coroutine yields */
+	void (*suspended)(void *);
+
+	/** the argument to the suspended function */
+	void *suspended_arg;
+
+	/** true when the coroutine function has returned */
+	bool finished;
+};
+
+/** context of the current thread while it runs a coroutine */
+static __thread ucontext_t thread_ctx;
+
+/** coroutine running on the current thread */
+static __thread struct coroutine *current_co;
+
+/** number of unfinished coroutines created by the current thread */
+static __thread int live_count;
+
+/** stacks cached by the current thread */
+static __thread void *stack_cache[CORO_STACK_CACHE];
+
+/** number of stacks cached by the current thread */
+static __thread int stack_cache_count;
+
+/**
+ * Get a stack from the thread cache, or map a new one
+ * with a guard page below it.
+ *
+ * @return the stack or NULL if unavailable
+ */
+static void *get_stack(void) {
+	if (stack_cache_count > 0) {
+		return stack_cache[--stack_cache_count];
+	}
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	char *region = mmap(NULL, page_size + CORO_STACK_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (region == MAP_FAILED) {
+		return NULL;
+	}
+	if (mprotect(region, page_size, PROT_NONE) != 0) {
+		munmap(region, page_size + CORO_STACK_SIZE);
+		return NULL;
+	}
+	return region + page_size;
+}
+
+/**
+ * Return a stack to the thread cache, or unmap it if the cache is full.
+ *
+ * @param stack the stack
+ */
+static void put_stack(void *stack) {
+	if (stack_cache_count < CORO_STACK_CACHE) {
+		stack_cache[stack_cache_count++] = stack;
+		return;
+	}
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	munmap((char *)stack - page_size, page_size + CORO_STACK_SIZE);
+}
+
+/**
+ * Entry point of every coroutine: runs the coroutine function
+ * and returns to the resuming thread for the last time.
+ */
+static void coro_main(void) {
+	struct coroutine *co = current_co;
+	co->function(co->arg);
+	co->finished = true;
+	setcontext(co->caller);
+}
+
+/**
+ * Create a coroutine that runs a function when first resumed.
+ *
+ * @param function the coroutine function
+ * @param arg the argument to the function
+ * @return the coroutine or NULL if unavailable
+ */
+struct coroutine *coro_new(void (*function)(void *), void *arg) {
+	char *stack = get_stack();
+	if (stack == NULL) {
+		return NULL;
+	}
+	struct coroutine *co = (struct coroutine *)(stack + CORO_STACK_SIZE) - 1;
+	co->stack = stack;
+	// getcontext() may return twice: use only the coroutine after it
+	if (getcontext(&co->ctx) != 0) {
+		put_stack(co->stack);
+		return NULL;
+	}
+	co->ctx.uc_stack.ss_sp = co->stack;
+	co->ctx.uc_stack.ss_size = (char *)co - (char *)co->stack;
+	co->ctx.uc_link = NULL;
+	makecontext(&co->ctx, coro_main, 0);
+
+	co->function = function;
+	co->arg = arg;
+	co->suspended = NULL;
+	co->finished = false;
+	live_count++;
+	return co;
+}
+
+/**
+ * Run a coroutine until it yields or its function returns.
+ * A coroutine is deleted when its function returns.
+ *
+ * @param co the coroutine
+ * @return true if the coroutine finished and was deleted
+ */
+bool coro_resume(struct coroutine *co) {
+	struct coroutine *prev = current_co;
+	current_co = co;
+	co->caller = &thread_ctx;
+	swapcontext(&thread_ctx, &co->ctx);
+	current_co = prev;
+
+	if (co->finished) {
+		live_count--;
+		put_stack(co->stack);  // also frees the coroutine
+		return true;
+	}
+
+	// coroutine is no longer running, so it may now be resumed elsewhere
+	void (*suspended)(void *) = co->suspended;
+	co->suspended = NULL;
+	if (suspended != NULL) {
+		suspended(co->suspended_arg);
+	}
+	return false;
+}
+
+/**
+ * Yield the current coroutine to the thread that resumed it.
+ * The suspended function is called by that thread once the
+ * coroutine is no longer running, so it may arrange for the
+ * coroutine to be resumed by another thread.
+ *
+ * @param suspended the function called after the coroutine yields
+ * @param arg the argument to the suspended function
+ */
+void coro_yield(void (*suspended)(void *), void *arg) {
+	struct coroutine *co = current_co;
+	co->suspended = suspended;
+	co->suspended_arg = arg;
+	swapcontext(&co->ctx, co->caller);
+}
+
+/**
+ * Get the coroutine running on the calling thread.
+ *
+ * @return the coroutine or NULL if none
+ */
+struct coroutine *coro_current(void) {
+	return current_co;
+}
+
+/**
+ * Get the number of coroutines created by the calling thread
+ * that have not yet finished.
+ *
+ * @return the number of coroutines
+ */
+int coro_count(void) {
+	return live_count;
+}
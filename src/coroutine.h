@@ -0,0 +1,67 @@
+/*
+ * coroutine.h
+ *
+ * Stackful coroutines with pooled stacks, used to run request
+ * handlers that can yield their worker thread while waiting
+ * for a socket instead of blocking it.
+ *
+ * A coroutine must be resumed by the thread that created it,
+ * because code running in it may hold the addresses of thread
+ * local variables such as errno across a yield.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+#include <stdbool.h>
+
+/** a coroutine */
+struct coroutine;
+
+/**
+ * Create a coroutine that runs a function when first resumed.
+ *
+ * @param function the coroutine function
+ * @param arg the argument to the function
+ * @return the coroutine or NULL if unavailable
+ */
+struct coroutine *coro_new(void (*function)(void *), void *arg);
+
+/**
+ * Run a coroutine until it yields or its function returns.
+ * A coroutine is deleted when its function returns.
+ *
+ * @param co the coroutine
+ * @return true if the coroutine finished and was deleted
+ */
+bool coro_resume(struct coroutine *co);
+
+/**
+ * Yield the current coroutine to the thread that resumed it.
+ * The suspended function is called by that thread once the
+ * coroutine is no longer running, so it may arrange for the
+ * coroutine to be resumed by another thread.
+ *
+ * @param suspended the function called after the coroutine yields
+ * @param arg the argument to the suspended function
+ */
+void coro_yield(void (*suspended)(void *), void *arg);
+
+/**
+ * Get the coroutine running on the calling thread.
+ *
+ * @return the coroutine or NULL if none
+ */
+struct coroutine *coro_current(void);
+
+/**
+ * Get the number of coroutines created by the calling thread
+ * that have not yet finished.
+ *
+ * @return the number of coroutines
+ */
+int coro_count(void);
+
+#endif /* COROUTINE_H_ */
@@ -0,0 +1,769 @@
+/*
+ * event_loop.c
+ *
+ * Non-blocking epoll reactor that owns the listener and
+ * client sockets, and dispatches a connection to the worker
+ * threads once a complete request has been received. The io_uring
+ * backend uses multishot accept and recv completions instead.
+ *
+ *  @since 2020-04-22
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "event_loop.h"
+#include "http_request.h"
+#include "http_server.h"
+#include "network_util.h"
+#include "time_util.h"
+
+/** maximum number of connections accepted for one listener event */
+#define ACCEPT_BATCH 64
+
+
+/** initial limit on requests in flight for each worker */
+#define ADMISSION_PER_WORKER 4
+
+/**
+ * Arm a client connection for one event. Connections use
+ * EPOLLONESHOT so that a connection being processed by a
+ * worker does not also generate events for the loop.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ * @param op EPOLL_CTL_ADD or EPOLL_CTL_MOD
+ * @param events EPOLLIN or EPOLLOUT
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int arm_connection(struct event_loop *loop, struct connection *conn, int op, unsigned events) {
+	struct epoll_event ev;
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = conn;
+	return epoll_ctl(loop->epoll_fd, op, conn->fd, &ev);
+}
+
+/**
+ * Initialize an event loop for a listener socket.
+ *
+ * @param loop the event loop
+ * @param listen_fd the listener socket
+ * @param unix_fd the UNIX domain listener socket, or -1 if none
+ * @param sched the scheduler of the worker threads that process requests
+ * @return 0 if successful, -1 with errno set if error
+ */
+int event_loop_init(struct event_loop *loop, int listen_fd, int unix_fd, struct scheduler *sched) {
+	loop->listen_fd = listen_fd;
+	loop->unix_fd = unix_fd;
+	loop->sched = sched;
+	loop->use_uring = server.io_uring;
+	loop->resumed = NULL;
+	loop->nconnections = 0;
+	loop->drain_requested = loop->draining = false;
+	timer_wheel_init(&loop->timers, monotonicTimeNanos() / 1000000);
+	pthread_mutex_init(&loop->resume_lock, NULL);
+
+	// limit starts a few requests per worker, and may grow until queues are full
+	int nworkers = scheduler_worker_count(sched);
+	admission_init(&loop->admission, nworkers, nworkers * SCHEDULER_QUEUE_CAPACITY,
+			nworkers * ADMISSION_PER_WORKER, server.admission_latency);
+
+	// refused requests get a response prepared once, without a worker
+	if (server.retry_after > 0) {
+		loop->busy_len = snprintf(loop->busy_response, BUSY_RESPONSE_SIZE,
+				"%s 503 Service Unavailable" CRLF "Retry-After: %d" CRLF
+				"Content-Length: 0" CRLF "Connection: close" CRLF CRLF,
+				server.server_protocol, server.retry_after);
+	} else {
+		loop->busy_len = snprintf(loop->busy_response, BUSY_RESPONSE_SIZE,
+				"%s 503 Service Unavailable" CRLF
+				"Content-Length: 0" CRLF "Connection: close" CRLF CRLF,
+				server.server_protocol);
+	}
+
+	// workers wake the loop when they return a connection
+	loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (loop->wake_fd < 0) {
+		return -1;
+	}
+
+	if (loop->use_uring) {
+		return uring_init(&loop->ring, LOOP_RING_ENTRIES);
+	}
+
+	// listeners must not block when the backlog is empty
+	int flags = fcntl(listen_fd, F_GETFL, 0);
+	if ((flags < 0) || (fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+		return -1;
+	}
+	if (unix_fd >= 0) {
+		flags = fcntl(unix_fd, F_GETFL, 0);
+		if ((flags < 0) || (fcntl(unix_fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+			return -1;
+		}
+	}
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		return -1;
+	}
+
+	// listener is identified by a NULL data pointer
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+		close(loop->epoll_fd);
+		return -1;
+	}
+
+	// UNIX domain listener is shared by all loops, and is identified
+	// by the address of unix_fd; only one loop is woken per connection
+	if (unix_fd >= 0) {
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.ptr = &loop->unix_fd;
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, unix_fd, &ev) < 0) {
+			close(loop->epoll_fd);
+			return -1;
+		}
+	}
+
+	// wake event is identified by the address of wake_fd
+	ev.events = EPOLLIN;
+	ev.data.ptr = &loop->wake_fd;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) {
+		close(loop->epoll_fd);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Get a submission entry from the loop ring, submitting
+ * pending entries first if the submission queue is full.
+ *
+ * @param loop the event loop
+ * @return the submission entry
+ */
+static struct io_uring_sqe *get_loop_sqe(struct event_loop *loop) {
+	struct io_uring_sqe *sqe;
+	while ((sqe = uring_get_sqe(&loop->ring)) == NULL) {
+		uring_submit(&loop->ring, 0);
+	}
+	return sqe;
+}
+
+/**
+ * Prepare a multishot accept on a listener socket, or a single
+ * accept if the kernel does not support multishot. The TCP
+ * listener is identified by zero user data, and the UNIX domain
+ * listener by the address of unix_fd.
+ *
+ * @param loop the event loop
+ * @param listen_fd the listener socket
+ */
+static void prep_uring_accept(struct event_loop *loop, const int *listen_fd) {
+	struct io_uring_sqe *sqe = get_loop_sqe(loop);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = *listen_fd;
+	sqe->ioprio = uring_multishot_accept() ? IORING_ACCEPT_MULTISHOT : 0;
+	// ring operations ignore O_NONBLOCK, but handlers must not block in sendfile() or splice()
+	sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+	sqe->user_data = (listen_fd == &loop->unix_fd) ? (uintptr_t)listen_fd : 0;
+}
+
+/**
+ * Prepare a read of the wake event counter. The wake
+ * event is identified by the address of wake_fd.
+ *
+ * @param loop the event loop
+ */
+static void prep_uring_wake(struct event_loop *loop) {
+	struct io_uring_sqe *sqe = get_loop_sqe(loop);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = loop->wake_fd;
+	sqe->addr = (uintptr_t)&loop->wake_count;
+	sqe->len = sizeof(loop->wake_count);
+	sqe->user_data = (uintptr_t)&loop->wake_fd;
+}
+
+/**
+ * Prepare a timeout for the next tick of the timing wheel.
+ * The timeout is identified by the address of the wheel.
+ *
+ * @param loop the event loop
+ */
+static void prep_uring_tick(struct event_loop *loop) {
+	loop->tick_ts.tv_sec = 0;
+	loop->tick_ts.tv_nsec = TIMER_TICK_MS * 1000000L;
+	struct io_uring_sqe *sqe = get_loop_sqe(loop);
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)&loop->tick_ts;
+	sqe->len = 1;
+	sqe->user_data = (uintptr_t)&loop->timers;
+}
+
+/**
+ * Prepare a receive into the connection receive buffer.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void prep_uring_recv(struct event_loop *loop, struct connection *conn) {
+	size_t room = conn_rbuf_prepare(conn);
+	struct io_uring_sqe *sqe = get_loop_sqe(loop);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->fd;
+	sqe->addr = (uintptr_t)(conn->rbuf + conn->rlen);
+	sqe->len = room;
+	sqe->user_data = (uintptr_t)conn;
+}
+
+/**
+ * Prepare a poll for the socket events that a suspended
+ * request handler is waiting for.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void prep_uring_poll(struct event_loop *loop, struct connection *conn) {
+	struct io_uring_sqe *sqe = get_loop_sqe(loop);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = conn->fd;
+	sqe->poll32_events = conn->wait_events;
+	sqe->user_data = (uintptr_t)conn;
+}
+
+/**
+ * Get the current monotonic time for connection deadlines.
+ *
+ * @return the time in milliseconds
+ */
+static uint64_t now_ms(void) {
+	return monotonicTimeNanos() / 1000000;
+}
+
+/**
+ * Close a connection owned by the event loop.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void close_connection(struct event_loop *loop, struct connection *conn) {
+	timer_cancel(&conn->timer);
+	conn_delete(conn);
+	__atomic_sub_fetch(&loop->nconnections, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Wait for more request bytes on a connection. A connection
+ * with no request bytes waits until the keep-alive deadline; once
+ * a request begins, or from when a new connection is accepted,
+ * its line and headers must arrive by the header deadline.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ * @param added true if connection is not yet known to the loop
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int wait_for_request(struct event_loop *loop, struct connection *conn, bool added) {
+	if (loop->use_uring) {
+		prep_uring_recv(loop, conn);
+	} else if (arm_connection(loop, conn, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, EPOLLIN) < 0) {
+		return -1;
+	}
+
+	if (!timer_pending(&conn->timer)) {
+		uint64_t deadline = (conn->request_start != 0)
+				? conn->request_start + server.header_timeout * 1000ULL
+				: now_ms() + server.keep_alive_timeout * 1000ULL;
+		timer_schedule(&loop->timers, &conn->timer, deadline);
+	}
+	return 0;
+}
+
+/**
+ * Wait for the socket events that a suspended request handler
+ * is waiting for.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int wait_for_handler(struct event_loop *loop, struct connection *conn) {
+	// each wait for body bytes or response room is bounded,
+	// and so is the time for the whole request
+	uint64_t deadline = now_ms() + server.body_timeout * 1000ULL;
+	uint64_t request_deadline = conn->request_start + server.request_timeout * 1000ULL;
+	timer_schedule(&loop->timers, &conn->timer,
+			(deadline < request_deadline) ? deadline : request_deadline);
+
+	if (loop->use_uring) {
+		prep_uring_poll(loop, conn);
+		return 0;
+	}
+	return arm_connection(loop, conn, EPOLL_CTL_MOD, conn->wait_events);
+}
+
+/**
+ * Resume a suspended request handler on the worker that
+ * created its coroutine, now that its socket is ready.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void resume_handler(struct event_loop *loop, struct connection *conn) {
+	conn->wait_events = 0;
+	timer_cancel(&conn->timer);
+
+	// a request already being served is always admitted
+	admission_acquire(&loop->admission, true);
+	conn->dispatched = monotonicTimeNanos();
+	if (scheduler_add_pinned_work(loop->sched, conn->worker, param_adapter, conn) != 0) {
+		// cannot happen: a worker limits its coroutines to its queue capacity
+		perror("scheduler_add_pinned_work");
+	}
+}
+
+/**
+ * Close a connection whose deadline has passed. A connection with
+ * a pending io_uring operation or a suspended handler is shut down
+ * instead, which completes the operation or resumes the handler,
+ * and the connection is then closed by the loop or the handler.
+ *
+ * @param data the connection
+ * @param arg the event loop
+ */
+static void connection_expired(void *data, void *arg) {
+	struct event_loop *loop = arg;
+	struct connection *conn = data;
+	if (server.debug) {
+		fprintf(stderr, "Connection timed out\n");
+	}
+	if (loop->use_uring || conn->co != NULL) {
+		shutdown(conn->fd, SHUT_RDWR);
+	} else {
+		close_connection(loop, conn);
+	}
+}
+
+/**
+ * Register a newly accepted client socket with the event loop.
+ *
+ * @param loop the event loop
+ * @param socket_fd the client socket
+ */
+static void add_connection(struct event_loop *loop, int socket_fd) {
+	if (server.debug) {
+		int port;
+		char host[MAXBUF];
+		if (get_peer_host_and_port(socket_fd, host, &port) != 0) {
+			perror("get_peer_host_and_port");
+		} else if (port == 0) {  // UNIX domain peer
+			fprintf(stderr, "New connection accepted  %s\n", host);
+		} else {
+			fprintf(stderr, "New connection accepted  %s:%u\n", host, port);
+		}
+	}
+
+	struct connection *conn = conn_new(socket_fd, loop);
+	if (conn == NULL) {
+		perror("conn_new");
+		close(socket_fd);
+		return;
+	}
+	__atomic_add_fetch(&loop->nconnections, 1, __ATOMIC_RELAXED);
+	conn->request_start = now_ms();  // header deadline runs from accept
+	if (wait_for_request(loop, conn, true) < 0) {
+		perror("wait_for_request");
+		close_connection(loop, conn);
+	}
+}
+
+/**
+ * Accept a batch of pending connections on a listener and
+ * register them with the event loop. The listener is level
+ * triggered, so connections remaining in the backlog are
+ * accepted on the next wait, after other ready events.
+ *
+ * @param loop the event loop
+ * @param listen_fd the listener socket
+ */
+static void accept_connections(struct event_loop *loop, int listen_fd) {
+	int socket_fds[ACCEPT_BATCH];
+	int naccepted = accept_peer_connections(listen_fd, socket_fds, ACCEPT_BATCH);
+	for (int i = 0; i < naccepted; i++) {
+		add_connection(loop, socket_fds[i]);
+	}
+}
+
+/**
+ * Wait for the next request on connections returned by workers,
+ * or for the socket events that suspended handlers wait for.
+ *
+ * @param loop the event loop
+ */
+static void resume_connections(struct event_loop *loop) {
+	pthread_mutex_lock(&loop->resume_lock);
+	struct connection *conn = loop->resumed;
+	loop->resumed = NULL;
+	pthread_mutex_unlock(&loop->resume_lock);
+
+	while (conn != NULL) {
+		struct connection *next = conn->next;
+		conn->next = NULL;
+		if (conn->wait_events != 0) {
+			if (wait_for_handler(loop, conn) < 0) {
+				// handler finds out when it retries the socket
+				perror("wait_for_handler");
+				resume_handler(loop, conn);
+			}
+		} else {
+			// pipelined bytes already received begin the next request
+			conn->request_start = (conn->rlen > conn->rpos) ? now_ms() : 0;
+			if (wait_for_request(loop, conn, false) < 0) {
+				perror("wait_for_request");
+				close_connection(loop, conn);
+			}
+		}
+		conn = next;
+	}
+}
+
+/**
+ * Refuse a request because the workers are overloaded, with a
+ * response sent directly by the loop, and close the connection.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void refuse_request(struct event_loop *loop, struct connection *conn) {
+	if (server.debug) {
+		fprintf(stderr, "Request refused: limit %.0f\n", loop->admission.limit);
+	}
+	// best effort: the socket buffer of a new response is empty
+	send(conn->fd, loop->busy_response, loop->busy_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	close_connection(loop, conn);
+}
+
+/**
+ * Dispatch a connection with a received request to a worker
+ * thread, or refuse the request if admission control does not
+ * admit it or the worker queues are full.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void dispatch_request(struct event_loop *loop, struct connection *conn) {
+	uint64_t now = monotonicTimeNanos();
+	admission_update(&loop->admission, now);
+	if (!admission_acquire(&loop->admission, false)) {
+		refuse_request(loop, conn);
+		return;
+	}
+
+	timer_cancel(&conn->timer);
+	conn->dispatched = now;
+	if (scheduler_add_work(loop->sched, param_adapter, conn) != 0) {
+		admission_release(&loop->admission, 0);
+		refuse_request(loop, conn);
+	}
+}
+
+/**
+ * Handle the result of receiving request bytes on a client connection.
+ * Dispatch the connection to a worker thread if the request line and
+ * headers are complete, otherwise wait for more bytes.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ * @param nread the receive result
+ */
+static void received(struct event_loop *loop, struct connection *conn, ssize_t nread) {
+	if (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		close_connection(loop, conn);
+		return;
+	}
+	if (nread == 0 && conn->rlen == conn->rpos) {  // closed without request
+		close_connection(loop, conn);
+		return;
+	}
+
+	// first bytes of a request replace the keep-alive deadline with the header deadline
+	if (conn->request_start == 0 && conn->rlen > conn->rpos) {
+		conn->request_start = now_ms();
+		timer_cancel(&conn->timer);
+	}
+
+	// a full buffer or a closed peer is handled by the worker
+	if (conn_request_ready(conn) || conn_rbuf_full(conn) || conn->eof) {
+		dispatch_request(loop, conn);
+	} else if (wait_for_request(loop, conn, false) < 0) {
+		perror("wait_for_request");
+		close_connection(loop, conn);
+	}
+}
+
+/**
+ * Stop accepting connections on a listener.
+ *
+ * @param loop the event loop
+ * @param listen_fd the listener socket
+ */
+static void cancel_accept(struct event_loop *loop, const int *listen_fd) {
+	if (loop->use_uring) {
+		// cancellation is identified by the address of listen_fd
+		struct io_uring_sqe *sqe = get_loop_sqe(loop);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (listen_fd == &loop->unix_fd) ? (uintptr_t)listen_fd : 0;
+		sqe->user_data = (uintptr_t)&loop->listen_fd;
+	} else if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, *listen_fd, NULL) < 0) {
+		perror("epoll_ctl");
+	}
+}
+
+/**
+ * Stop accepting connections once another thread has requested
+ * that the loop drain. The listeners remain open, so connections
+ * not yet accepted stay queued for another server sharing them.
+ *
+ * @param loop the event loop
+ */
+static void stop_accepting(struct event_loop *loop) {
+	loop->draining = true;
+	loop->drain_deadline = now_ms() + server.drain_timeout * 1000ULL;
+
+	cancel_accept(loop, &loop->listen_fd);
+	if (loop->unix_fd >= 0) {
+		cancel_accept(loop, &loop->unix_fd);
+	}
+}
+
+/**
+ * Determine whether the event loop should exit: it is draining,
+ * and its connections are closed or the drain timeout has passed.
+ * Starts draining if another thread has requested it.
+ *
+ * @param loop the event loop
+ * @return true if the loop should exit
+ */
+static bool drained(struct event_loop *loop) {
+	if (!loop->draining) {
+		if (!__atomic_load_n(&loop->drain_requested, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+		stop_accepting(loop);
+	}
+	return (__atomic_load_n(&loop->nconnections, __ATOMIC_RELAXED) == 0)
+			|| (now_ms() >= loop->drain_deadline);
+}
+
+/**
+ * Run the io_uring event loop. Completions are processed in
+ * batches, and the entries they prepare are submitted together
+ * with the wait for the next batch.
+ *
+ * @param loop the event loop
+ */
+static void event_loop_run_uring(struct event_loop *loop) {
+	prep_uring_accept(loop, &loop->listen_fd);
+	if (loop->unix_fd >= 0) {
+		prep_uring_accept(loop, &loop->unix_fd);
+	}
+	prep_uring_wake(loop);
+	prep_uring_tick(loop);
+
+	while (!drained(loop)) {
+		if (uring_submit(&loop->ring, 1) < 0) {
+			perror("io_uring_enter");
+			continue;
+		}
+
+		struct io_uring_cqe *cqe;
+		while ((cqe = uring_peek_cqe(&loop->ring)) != NULL) {
+			void *data = (void *)(uintptr_t)cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+			uring_cqe_seen(&loop->ring);
+
+			if (data == NULL || data == &loop->unix_fd) {  // listener
+				const int *listen_fd = (data == NULL) ? &loop->listen_fd : &loop->unix_fd;
+				if (res >= 0) {
+					add_connection(loop, res);
+				} else if (res == -EMFILE || res == -ENFILE) {
+					shed_peer_connection(*listen_fd);
+				} else if (res == -EINVAL || res == -EBADF || res == -ENOTSOCK || res == -EOPNOTSUPP) {
+					// the listener or the request is invalid: retrying would fail again
+					errno = -res;
+					perror("accept: io_uring stopped accepting");
+					continue;
+				} else if (res != -EAGAIN && res != -ECONNABORTED && res != -ECANCELED) {
+					errno = -res;
+					perror("accept");
+				}
+				if ((flags & IORING_CQE_F_MORE) == 0 && !loop->draining) {  // accept ended
+					prep_uring_accept(loop, listen_fd);
+				}
+			} else if (data == &loop->listen_fd) {  // accept cancelled
+				continue;
+			} else if (data == &loop->wake_fd) {
+				resume_connections(loop);
+				prep_uring_wake(loop);
+			} else if (data == &loop->timers) {
+				timer_wheel_advance(&loop->timers, now_ms(), connection_expired, loop);
+				prep_uring_tick(loop);
+			} else if (((struct connection *)data)->co != NULL) {  // handler poll
+				resume_handler(loop, data);
+			} else {
+				struct connection *conn = data;
+				if (res < 0) {
+					errno = -res;
+				}
+				conn_rbuf_commit(conn, res);
+				received(loop, conn, res);
+			}
+		}
+	}
+}
+
+/**
+ * Run the event loop, accepting connections and dispatching
+ * requests to the worker threads.
+ *
+ * @param loop the event loop
+ */
+void event_loop_run(struct event_loop *loop) {
+	if (loop->use_uring) {
+		event_loop_run_uring(loop);
+		return;
+	}
+
+	struct epoll_event events[MAX_LOOP_EVENTS];
+	while (!drained(loop)) {
+		int nevents = epoll_wait(loop->epoll_fd, events, MAX_LOOP_EVENTS, TIMER_TICK_MS);
+		if (nevents < 0) {
+			if (errno != EINTR) {
+				perror("epoll_wait");
+			}
+			continue;
+		}
+
+		for (int i = 0; i < nevents; i++) {
+			void *data = events[i].data.ptr;
+			if (data == NULL) {
+				if (!loop->draining) {
+					accept_connections(loop, loop->listen_fd);
+				}
+			} else if (data == &loop->unix_fd) {
+				if (!loop->draining) {
+					accept_connections(loop, loop->unix_fd);
+				}
+			} else if (data == &loop->wake_fd) {
+				uint64_t count;
+				if (read(loop->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+					perror("read wake_fd");
+				}
+				resume_connections(loop);
+			} else if (((struct connection *)data)->co != NULL) {
+				resume_handler(loop, data);
+			} else {
+				struct connection *conn = data;
+				received(loop, conn, conn_fill(conn, false));
+			}
+		}
+		timer_wheel_advance(&loop->timers, now_ms(), connection_expired, loop);
+	}
+}
+
+/**
+ * Record the latency of a worker serving a connection since it
+ * was dispatched, when the worker finishes or suspends serving it.
+ *
+ * @param conn the connection
+ */
+static void finish_request(struct connection *conn) {
+	admission_release(&conn->loop->admission, monotonicTimeNanos() - conn->dispatched);
+}
+
+/**
+ * Add a connection to the list of connections returned to the
+ * event loop by workers, and wake the loop.
+ *
+ * @param conn the connection
+ */
+static void return_connection(struct connection *conn) {
+	struct event_loop *loop = conn->loop;
+	finish_request(conn);
+
+	// loop only needs waking if it has not been woken already
+	pthread_mutex_lock(&loop->resume_lock);
+	bool wake = (loop->resumed == NULL);
+	conn->next = loop->resumed;
+	loop->resumed = conn;
+	pthread_mutex_unlock(&loop->resume_lock);
+
+	if (wake) {
+		uint64_t one = 1;
+		if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+			perror("write wake_fd");
+		}
+	}
+}
+
+/**
+ * Called by a worker to return a persistent connection to the
+ * event loop, which waits for the next request on it.
+ *
+ * @param conn the connection
+ */
+void event_loop_resume(struct connection *conn) {
+	return_connection(conn);
+}
+
+/**
+ * Called by a worker after a request handler coroutine yields
+ * waiting for the socket events in conn->wait_events. The loop
+ * resumes the handler on the same worker once they occur.
+ *
+ * @param conn the connection
+ */
+void event_loop_suspend(void *conn) {
+	return_connection(conn);
+}
+
+/**
+ * Called by a worker when it is finished with a connection.
+ *
+ * @param conn the connection
+ */
+void event_loop_close(struct connection *conn) {
+	struct event_loop *loop = conn->loop;
+	finish_request(conn);
+
+	// closing the socket also removes it from the epoll set
+	conn_delete(conn);
+	__atomic_sub_fetch(&loop->nconnections, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Called by another thread to make the event loop stop accepting
+ * connections, and return once its open connections are closed or
+ * the drain timeout has passed. Persistent connections are closed
+ * after their next response, or when they time out.
+ *
+ * @param loop the event loop
+ */
+void event_loop_drain(struct event_loop *loop) {
+	__atomic_store_n(&loop->drain_requested, true, __ATOMIC_RELEASE);
+	uint64_t one = 1;
+	if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+		perror("write wake_fd");
+	}
+}
@@ -0,0 +1,146 @@
+/*
+ * event_loop.h
+ *
+ * Non-blocking epoll reactor that owns the listener and
+ * client sockets, and dispatches a connection to the worker
+ * threads once a complete request has been received.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "admission.h"
+#include "connection.h"
+#include "scheduler.h"
+#include "timer_wheel.h"
+#include "uring.h"
+
+/** maximum number of events returned by one wait */
+#define MAX_LOOP_EVENTS 256
+
+/** number of submission entries of an io_uring event loop */
+#define LOOP_RING_ENTRIES 1024
+
+/** size of the response sent when a request is refused */
+#define BUSY_RESPONSE_SIZE 256
+
+/** event loop state */
+struct event_loop {
+	/** the epoll descriptor */
+	int epoll_fd;
+
+	/** the listener socket */
+	int listen_fd;
+
+	/** the UNIX domain listener socket shared by all loops, or -1 if none */
+	int unix_fd;
+
+	/** scheduler of the worker threads that process requests */
+	struct scheduler *sched;
+
+	/** admission control for requests dispatched to the workers */
+	struct admission admission;
+
+	/** response sent by the loop when a request is refused */
+	char busy_response[BUSY_RESPONSE_SIZE];
+
+	/** length of busy_response */
+	int busy_len;
+
+	/** true if loop uses io_uring rather than epoll */
+	bool use_uring;
+
+	/** the io_uring instance if use_uring is true */
+	struct uring ring;
+
+	/** eventfd that wakes the loop when workers resume connections */
+	int wake_fd;
+
+	/** buffer for reading the eventfd counter with io_uring */
+	uint64_t wake_count;
+
+	/** lock for the list of resumed connections */
+	pthread_mutex_t resume_lock;
+
+	/** connections returned by workers to wait for another request */
+	struct connection *resumed;
+
+	/** deadlines of connections waiting for a request or socket events */
+	struct timer_wheel timers;
+
+	/** timeout between ticks of the timing wheel with io_uring */
+	struct __kernel_timespec tick_ts;
+
+	/** number of open connections; updated by loop and workers */
+	unsigned nconnections;
+
+	/** set by another thread to stop accepting and drain connections */
+	bool drain_requested;
+
+	/** true once the loop has stopped accepting connections */
+	bool draining;
+
+	/** monotonic time in milliseconds when draining gives up */
+	uint64_t drain_deadline;
+};
+
+/**
+ * Initialize an event loop for a listener socket. The loop
+ * uses io_uring if enabled by the server configuration.
+ *
+ * @param loop the event loop
+ * @param listen_fd the listener socket
+ * @param unix_fd the UNIX domain listener socket, or -1 if none
+ * @param sched the scheduler of the worker threads that process requests
+ * @return 0 if successful, -1 with errno set if error
+ */
+int event_loop_init(struct event_loop *loop, int listen_fd, int unix_fd, struct scheduler *sched);
+
+/**
+ * Run the event loop, accepting connections and dispatching
+ * requests to the worker threads, until it has drained.
+ *
+ * @param loop the event loop
+ */
+void event_loop_run(struct event_loop *loop);
+
+/**
+ * Called by another thread to make the event loop stop accepting
+ * connections, and return once its open connections are closed or
+ * the drain timeout has passed. Persistent connections are closed
+ * after their next response, or when they time out.
+ *
+ * @param loop the event loop
+ */
+void event_loop_drain(struct event_loop *loop);
+
+/**
+ * Called by a worker to return a persistent connection to the
+ * event loop, which waits for the next request on it.
+ *
+ * @param conn the connection
+ */
+void event_loop_resume(struct connection *conn);
+
+/**
+ * Called by a worker after a request handler coroutine yields
+ * waiting for the socket events in conn->wait_events. The loop
+ * resumes the handler on the same worker once they occur.
+ *
+ * @param conn the connection
+ */
+void event_loop_suspend(void *conn);
+
+/**
+ * Called by a worker when it is finished with a connection.
+ *
+ * @param conn the connection
+ */
+void event_loop_close(struct connection *conn);
+
+#endif /* EVENT_LOOP_H_ */
@@ -46,29 +46,6 @@ int fileStat(FILE *stream, struct stat *buf) {
 }
 
 
-/**
- * Copy bytes from input stream to output stream
- * @param istream the input stream
- * @param ostream the output stream
- * @param nbytes the number of bytes to send
- * @param return 0 if successful
- */
-int copyFileStreamBytes(FILE *istream, FILE *ostream, int nbytes) {
-	char buf[MAXBUF];
-    while ((nbytes > 0) && !feof(istream)) {
-    	int ntoread = (nbytes < MAXBUF) ? nbytes : MAXBUF;
-        size_t nread = fread(buf, sizeof(char), ntoread, istream);
-        if (nread > 0) {
-			if (fwrite(buf, sizeof(char), nread, ostream) < nread) {
-				perror("copyFileStreamBytes");
-				return -1;
-			}
-			nbytes -= nread;
-		}
-    }
-    return 0;
-}
-
 /**
  * Returns path component of the file path without trailing
  * path separator. If no path component, returns NULL.
@@ -184,7 +161,7 @@ int timespec2str(char *buf, uint len, struct timespec *ts) {
     len -= ret - 1;
 
     //ret = snprintf(&buf[strlen(buf)], len, ".%09ld", ts->tv_nsec);
-    if (ret >= len)
+    if ((uint)ret >= len)
         return 3;
 
     return 0;
@@ -196,7 +173,7 @@ int timespec2str(char *buf, uint len, struct timespec *ts) {
  * @param path the path to the directory
  * @return FILE pointer to the file listing contents of the directory
  */
-static FILE *dir_listings(const char *uri, const char *path) {
+FILE *dir_listings(const char *uri, const char *path) {
     char filePath[MAXPATHLEN];
     const char *fileInDir[MAXBUF];
 //    char buf[MAXBSIZE];
@@ -42,15 +42,6 @@ FILE *tmpStringFile(const char *contentStr);
  */
 int fileStat(FILE *stream, struct stat *buf);
 
-/**
- * Copy bytes from input stream to output stream
- * @param istream the input stream
- * @param ostream the output stream
- * @param nbytes the number of bytes to send
- * @param return 0 if successful
- */
-int copyFileStreamBytes(FILE *istream, FILE *ostream, int nbytes);
-
 /**
  * Returns path component of the file path without trailing
  * path separator. If no path component, returns NULL.
@@ -107,7 +98,7 @@ int mkdirs(const char *path, mode_t mode);
  * @param path the path to the directory
  * @return FILE pointer to the file listing contents of the directory
  */
-static FILE *dir_listings(const char *uri, const char *path);
+FILE *dir_listings(const char *uri, const char *path);
 
 int timespec2str(char *buf, unsigned int len, struct timespec *ts);
 #endif /* FILE_UTIL_H_ */
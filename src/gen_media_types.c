@@ -0,0 +1,225 @@
+/*
+ * gen_media_types.c
+ *
+ * Build tool that reads a "mime.types" file and writes the
+ * built-in media type table as a perfect hash table: each hash
+ * bucket has a displacement chosen so that every extension maps
+ * to its own slot, and a lookup is one probe.
+ *
+ * usage: gen_media_types mime.types media_types.h
+ *
+ *  @since 2020-04-22
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "media_util.h"
+
+/** largest displacement tried before growing the table */
+#define MAX_DISP 65536
+
+/** an extension and its media type */
+struct entry {
+	char *ext;
+	size_t len;
+	char *type;
+	uint32_t hash;
+};
+
+/**
+ * Read the extensions of a "mime.types" file. Extensions are
+ * lower-cased; the first media type of an extension is used.
+ *
+ * @param filename the name of the file
+ * @param nentries returns the number of extensions
+ * @return the extensions, or NULL if the file cannot be read
+ */
+static struct entry *read_entries(const char *filename, size_t *nentries) {
+	FILE *stream = fopen(filename, "r");
+	if (stream == NULL) {
+		perror(filename);
+		return NULL;
+	}
+	struct entry *entries = NULL;
+	size_t n = 0, max = 0;
+	char *line = NULL;
+	size_t linelen = 0;
+	while (getline(&line, &linelen, stream) != -1) {
+		char *save;
+		char *type = strtok_r(line, " \t\r\n", &save);
+		if ((type == NULL) || (type[0] == '#')) {
+			continue;
+		}
+		for (char *ext; (ext = strtok_r(NULL, " \t\r\n", &save)) != NULL; ) {
+			for (char *p = ext; *p != '\0'; p++) {
+				if ((*p >= 'A') && (*p <= 'Z')) {
+					*p += 'a' - 'A';
+				}
+			}
+			bool dup = false;
+			for (size_t i = 0; (i < n) && !dup; i++) {
+				dup = (strcmp(entries[i].ext, ext) == 0);
+			}
+			if (dup) {
+				continue;
+			}
+			if (n == max) {
+				max = (max == 0) ? 1024 : 2 * max;
+				entries = realloc(entries, max * sizeof(struct entry));
+			}
+			entries[n].ext = strdup(ext);
+			entries[n].len = strlen(ext);
+			entries[n].type = strdup(type);
+			entries[n].hash = media_hash(ext, entries[n].len);
+			n++;
+		}
+	}
+	free(line);
+	fclose(stream);
+	*nentries = n;
+	return entries;
+}
+
+/**
+ * Choose bucket displacements so that every entry has its own slot.
+ *
+ * @param entries the entries
+ * @param n the number of entries
+ * @param nbuckets the number of buckets; a power of 2
+ * @param disp returns the displacement of each bucket
+ * @param nslots the number of slots; a power of 2
+ * @param slots returns the entry index of each slot plus 1, or 0 if empty
+ * @return true if displacements were found
+ */
+static bool place_entries(const struct entry *entries, size_t n, size_t nbuckets, uint32_t *disp,
+						  size_t nslots, size_t *slots) {
+	// place buckets with the most entries first
+	size_t *counts = calloc(nbuckets, sizeof(size_t));
+	for (size_t i = 0; i < n; i++) {
+		counts[entries[i].hash & (nbuckets - 1)]++;
+	}
+	size_t *members = malloc(n * sizeof(size_t));
+	memset(slots, 0, nslots * sizeof(size_t));
+	bool placed = true;
+	for (size_t size = n; (size > 0) && placed; size--) {
+		for (size_t b = 0; (b < nbuckets) && placed; b++) {
+			if (counts[b] != size) {
+				continue;
+			}
+			size_t m = 0;
+			for (size_t i = 0; i < n; i++) {
+				if ((entries[i].hash & (nbuckets - 1)) == b) {
+					members[m++] = i;
+				}
+			}
+			placed = false;
+			for (uint32_t d = 0; (d < MAX_DISP) && !placed; d++) {
+				size_t k;
+				for (k = 0; k < m; k++) {
+					size_t slot = media_slot(entries[members[k]].hash, d, nslots);
+					if (slots[slot] != 0) {
+						break;
+					}
+					slots[slot] = members[k] + 1;
+				}
+				placed = (k == m);
+				while (!placed && (k-- > 0)) {  // undo a partial placement
+					slots[media_slot(entries[members[k]].hash, d, nslots)] = 0;
+				}
+				disp[b] = d;
+			}
+		}
+	}
+	free(members);
+	free(counts);
+	return placed;
+}
+
+/**
+ * Write a string as a C string literal.
+ *
+ * @param stream the output stream
+ * @param s the string
+ */
+static void write_literal(FILE *stream, const char *s) {
+	fputc('"', stream);
+	for (; *s != '\0'; s++) {
+		if ((*s == '"') || (*s == '\\')) {
+			fputc('\\', stream);
+		}
+		fputc(*s, stream);
+	}
+	fputc('"', stream);
+}
+
+/**
+ * Write the media type table for a "mime.types" file.
+ *
+ * @param argc the number of arguments
+ * @param argv the "mime.types" file and the output file
+ * @return EXIT_SUCCESS if the table was written
+ */
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s mime.types media_types.h\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	size_t n;
+	struct entry *entries = read_entries(argv[1], &n);
+	if (entries == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	// at most two entries per bucket on average, and a table at most 4/5 full
+	size_t nbuckets = 1, nslots = 1;
+	while (nbuckets < n / 2) {
+		nbuckets *= 2;
+	}
+	while (nslots < n + n / 4) {
+		nslots *= 2;
+	}
+	uint32_t *disp = calloc(nbuckets, sizeof(uint32_t));
+	size_t *slots = malloc(nslots * sizeof(size_t));
+	while (!place_entries(entries, n, nbuckets, disp, nslots, slots)) {
+		if (nslots > 64 * n) {
+			fprintf(stderr, "%s: cannot make a perfect hash table\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		nslots *= 2;
+		slots = realloc(slots, nslots * sizeof(size_t));
+	}
+
+	FILE *stream = fopen(argv[2], "w");
+	if (stream == NULL) {
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	fprintf(stream, "/*\n * media_types.h\n *\n"
+			" * Generated from %s by gen_media_types. Do not edit.\n */\n\n", argv[1]);
+	fprintf(stream, "/** number of hash buckets */\n#define MEDIA_TYPE_BUCKETS %zu\n\n", nbuckets);
+	fprintf(stream, "/** number of table slots */\n#define MEDIA_TYPE_SLOTS %zu\n\n", nslots);
+	fprintf(stream, "/** displacement of each hash bucket */\n"
+			"static const uint32_t mediaTypeDisp[MEDIA_TYPE_BUCKETS] = {");
+	for (size_t b = 0; b < nbuckets; b++) {
+		fprintf(stream, "%s%u,", (b % 16 == 0) ? "\n\t" : " ", disp[b]);
+	}
+	fprintf(stream, "\n};\n\n/** built-in media types by slot */\n"
+			"static const struct media_type mediaTypes[MEDIA_TYPE_SLOTS] = {\n");
+	for (size_t s = 0; s < nslots; s++) {
+		if (slots[s] != 0) {
+			const struct entry *e = &entries[slots[s] - 1];
+			fprintf(stream, "\t[%zu] = {", s);
+			write_literal(stream, e->ext);
+			fprintf(stream, ", %zu, ", e->len);
+			write_literal(stream, e->type);
+			fprintf(stream, "},\n");
+		}
+	}
+	fprintf(stream, "};\n");
+	if (fclose(stream) != 0) {
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -18,6 +18,7 @@
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <dirent.h>
 
 #include "http_server.h"
@@ -27,89 +28,129 @@
 #include "properties.h"
 #include "string_util.h"
 #include "file_util.h"
+#include "connection.h"
+#include "uring.h"
 
 
+/**
+ * Send error response for GET or HEAD request. The error page
+ * sent for a HEAD request is not expected by the client, so the
+ * connection must be closed after it.
+ *
+ * @param conn the client connection
+ * @param status the response status
+ * @param statusMsg the response message
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void sendGetOrHeadError(struct connection *conn, int status, const char *statusMsg,
+							   Properties *responseHeaders, bool sendContent) {
+	if (!sendContent) {
+		setProperty(responseHeaders, "Connection", "close");
+	}
+	sendErrorResponse(conn, status, statusMsg, responseHeaders);
+}
+
 /**
  * Handle GET or HEAD request.
  *
- * @param stream the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  * @param sendContent send content (GET)
  */
-static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+static void do_get_or_head(struct connection *conn, const char *uri, Properties *responseHeaders, bool sendContent) {
 	// get path to URI in file system
 	char filePath[MAXPATHLEN];
 	resolveUri(uri, filePath);
-	FILE *contentStream = NULL;
+	FILE *dirPage = NULL;
 
-	// ensure file exists
+	// ensure file exists; for GET, io_uring also opens it in the same submission
 	struct stat sb;
-	if (stat(filePath, &sb) != 0) {
-		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+	int contentFd = -1;
+	bool found = false;
+	if (server.io_uring && sendContent) {
+		contentFd = uring_open_stat(filePath, &sb);
+		if (contentFd >= 0 && !S_ISREG(sb.st_mode)) {
+			close(contentFd);
+			contentFd = -1;
+		}
+		found = (contentFd >= 0);
+	} else if (server.io_uring) {
+		found = (uring_stat(filePath, &sb) == 0);
+	}
+	// use stat if io_uring did not find the file
+	if (!found && stat(filePath, &sb) != 0) {
+		sendGetOrHeadError(conn, 404, "Not Found", responseHeaders, sendContent);
 		return;
 	}
 	// directory path ends with '/'
 	if (S_ISDIR(sb.st_mode) && strendswith(filePath, "/")) {
 //		// not allowed for this method
-//		sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
-		contentStream = dir_listings(uri, filePath);
-        if (contentStream == NULL) {
-            sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
+//		sendErrorResponse(conn, 405, "Method Not Allowed", responseHeaders);
+		dirPage = dir_listings(uri, filePath);
+        if (dirPage == NULL) {
+            sendGetOrHeadError(conn, 405, "Method Not Allowed", responseHeaders, sendContent);
             return;
         }
 //        return;
-        fileStat(contentStream, &sb);
+        fileStat(dirPage, &sb);
+        contentFd = fileno(dirPage);
 	} else if (!S_ISREG(sb.st_mode)) { // error if not regular file
-		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+		sendGetOrHeadError(conn, 404, "Not Found", responseHeaders, sendContent);
 		return;
+	} else if (sendContent && contentFd < 0) {
+		// open before sending headers; fails if out of descriptors
+		contentFd = open(filePath, O_RDONLY);
+		if (contentFd < 0) {
+			sendGetOrHeadError(conn, 503, "Service Unavailable", responseHeaders, sendContent);
+			return;
+		}
 	}
 
 	// record the file length
 	char buf[MAXBUF];
 	size_t contentLen = (size_t)sb.st_size;
-	sprintf(buf,"%lu", contentLen);
+	utostr(buf, contentLen);
 	putProperty(responseHeaders,"Content-Length", buf);
 
 	// record the last-modified date/time
-	time_t timer = sb.st_mtim.tv_sec;
 	putProperty(responseHeaders,"Last-Modified",
-				milliTimeToRFC_1123_Date_Time(timer, buf));
+				fileTimeToRFC_1123_Date_Time(sb.st_mtim.tv_sec));
 
 	// get mime type of file
-	getMediaType(filePath, buf);
-	if (strcmp(buf, "text/directory") == 0) {
+	const char *mediaType = getMediaType(filePath);
+	if (strcmp(mediaType, "text/directory") == 0) {
 		// some browsers interpret text/directory as a VCF file
-		strcpy(buf,"text/html");
+		mediaType = "text/html";
 	}
-	putProperty(responseHeaders, "Content-type", buf);
+	putProperty(responseHeaders, "Content-type", mediaType);
 
-	// send response
-	sendResponseStatus(stream, 200, "OK");
-
-	// Send response headers
-	sendResponseHeaders(stream, responseHeaders);
+	// send response status and headers
+	sendResponse(conn, 200, "OK", responseHeaders, NULL, 0);
 
 	if (sendContent) {  // for GET
-		if (contentStream == NULL) {
-            contentStream = fopen(filePath, "r");
-        }
-		copyFileStreamBytes(contentStream, stream, contentLen);
-		fclose(contentStream);
+		if (conn_send_file(conn, contentFd, contentLen) != 0) {
+			// client cannot tell where a short response ends
+			setProperty(responseHeaders, "Connection", "close");
+		}
+	}
+	if (dirPage != NULL) {
+		fclose(dirPage);
+	} else if (contentFd >= 0) {
+		close(contentFd);
 	}
 }
 
 /**
  * Handle GET request.
  *
- * @param stream the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  * @param headOnly only perform head operation
  */
-void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+void do_get(struct connection *conn, const char *uri, Properties *responseHeaders) {
 //    // get path to URI in file system
 //    char filePath[MAXPATHLEN];
 //    char newUri[MAXPATHLEN] = "";
@@ -120,7 +161,7 @@ void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Propertie
 //    // ensure file exists
 //    struct stat sb;
 //    if (stat(filePath, &sb) != 0) {
-//        sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+//        sendErrorResponse(conn, 404, "Not Found", responseHeaders);
 //        return;
 //    }
 //
@@ -150,30 +191,28 @@ void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Propertie
 //
 //    } else {
 //    }
-    do_get_or_head(stream, uri, requestHeaders, responseHeaders, true);
+    do_get_or_head(conn, uri, responseHeaders, true);
 }
 
 /**
  * Handle HEAD request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
-	do_get_or_head(stream, uri, requestHeaders, responseHeaders, false);
+void do_head(struct connection *conn, const char *uri, Properties *responseHeaders) {
+	do_get_or_head(conn, uri, responseHeaders, false);
 }
 
 /**
  * Handle DELETE request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+void do_delete(struct connection *conn, const char *uri, Properties *responseHeaders) {
 	// get path to URI in file system
 	char filePath[MAXPATHLEN];
 	resolveUri(uri, filePath);
@@ -181,39 +220,65 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
 	// ensure file exists
 	struct stat sb;
 	if (stat(filePath, &sb) != 0) {
-		sendErrorResponse(stream, 404, "Not Found", responseHeaders);
+		sendErrorResponse(conn, 404, "Not Found", responseHeaders);
 		return;
 	}
 
 	// ensure it is a regular file or an empty directory
 	if (S_ISREG(sb.st_mode)) {
 		if (unlink(filePath) == 0) {
-			sendResponseStatus(stream, 200, "OK");
-			sendResponseHeaders(stream, responseHeaders);
+			putProperty(responseHeaders, "Content-Length", "0");
+			sendResponse(conn, 200, "OK", responseHeaders, NULL, 0);
 		} else {
-			sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
+			sendErrorResponse(conn, 405, "Method Not Allowed", responseHeaders);
 		}
 	} else if (S_ISDIR(sb.st_mode) && (strendswith(filePath, "/"))) {
 		if (rmdir(filePath) == 0) {
-			sendResponseStatus(stream, 200, "OK");
-			sendResponseHeaders(stream, responseHeaders);
+			putProperty(responseHeaders, "Content-Length", "0");
+			sendResponse(conn, 200, "OK", responseHeaders, NULL, 0);
 		} else {
-			sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
+			sendErrorResponse(conn, 405, "Method Not Allowed", responseHeaders);
 		}
+	} else {
+		sendErrorResponse(conn, 405, "Method Not Allowed", responseHeaders);
 	}
 
 	return;
 }
 
+/**
+ * Write the request body of a PUT or POST request to a file.
+ * If the body cannot be received or written, an error response
+ * is sent and the connection is closed, since the rest of the
+ * body is not read.
+ *
+ * @param conn the client connection
+ * @param fd the file descriptor
+ * @param contentLength the length of the request body
+ * @param responseHeaders the response headers
+ * @return true if the whole body was written
+ */
+static bool receiveBody(struct connection *conn, int fd, uint64_t contentLength, Properties *responseHeaders) {
+	if (conn_recv_file(conn, fd, contentLength) == 0) {
+		return true;
+	}
+	setProperty(responseHeaders, "Connection", "close");
+	if (conn->eof || conn->error) {  // client sent less than its length
+		sendErrorResponse(conn, 400, "Bad Request", responseHeaders);
+	} else {  // file could not be written
+		sendErrorResponse(conn, 500, "Internal Server Error", responseHeaders);
+	}
+	return false;
+}
+
 /**
  * Handle PUT request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+void do_put(struct connection *conn, const char *uri, Properties *responseHeaders) {
 	// get path to URI in file system
 	char filePath[MAXPATHLEN];
 	resolveUri(uri, filePath);
@@ -222,74 +287,86 @@ void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Propertie
 	// need to create a new resource if file doesn't exist
 	bool created = (stat(filePath, &sb) != 0);
 
+	// ensure content length is specified before touching the file
+	uint64_t contentLength = conn->request.content_length;
+	if (contentLength == HTTP_NO_CONTENT_LENGTH) {
+		setProperty(responseHeaders, "Connection", "close");
+		sendErrorResponse(conn, 411, "Length Required", responseHeaders);
+		return;
+	}
+
 	// create any intermediate directories
 	char pathOfFile[MAXPATHLEN];
 	if (getPath(filePath, pathOfFile) != NULL) {
 		mkdirs(pathOfFile, 0777);
 	}
 
-	// open a stream for filePath to write
-	FILE *putStream = fopen(filePath, "w");
+	// open filePath to write
+	int putFd = open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 	// if the server output file cannot be opened
-	if (putStream == NULL) {
-		sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
+	if (putFd < 0) {
+		// request body is not read
+		setProperty(responseHeaders, "Connection", "close");
+		sendErrorResponse(conn, 405, "Method Not Allowed", responseHeaders);
 		return;
 	}
 
-	// ensure content length is specified in the request header
-	char buf[MAXBUF];
-	if (findProperty(requestHeaders, 0, "Content-Length", buf) == SIZE_MAX) {
-		sendErrorResponse(stream, 411, "Length Required", responseHeaders);
-	} else {
-		copyFileStreamBytes(stream, putStream, atoi(buf));
+	bool received = receiveBody(conn, putFd, contentLength, responseHeaders);
+	close(putFd);
+	if (!received) {
+		return;
 	}
-	fclose(putStream);
 
+	putProperty(responseHeaders, "Content-Length", "0");
 	if (created) { // if the file is created in the server
-		sendResponseStatus(stream, 201, "Created");
+		sendResponse(conn, 201, "Created", responseHeaders, NULL, 0);
 	} else { // if the named file is overwritten
-		sendResponseStatus(stream, 200, "OK");
+		sendResponse(conn, 200, "OK", responseHeaders, NULL, 0);
 	}
-	sendResponseHeaders(stream, responseHeaders);
 }
 
 /**
  * Handle POST request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+void do_post(struct connection *conn, const char *uri, Properties *responseHeaders) {
 	// get path to URI in file system
 	char filePath[MAXPATHLEN];
 	resolveUri(uri, filePath);
 
+	// ensure content length is specified before touching the file
+	uint64_t contentLength = conn->request.content_length;
+	if (contentLength == HTTP_NO_CONTENT_LENGTH) {
+		setProperty(responseHeaders, "Connection", "close");
+		sendErrorResponse(conn, 411, "Length Required", responseHeaders);
+		return;
+	}
+
 	// create any intermediate directories
 	char pathOfFile[MAXPATHLEN];
 	if (getPath(filePath, pathOfFile) != NULL) {
 		mkdirs(pathOfFile, 0777);
 	}
 
-	// open a stream for filePath to write
-	FILE *postStream = fopen(filePath, "w");
+	// open filePath to write
+	int postFd = open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 	// if the server output file cannot be opened
-	if (postStream == NULL) {
-		sendErrorResponse(stream, 405, "Method Not Allowed", responseHeaders);
+	if (postFd < 0) {
+		// request body is not read
+		setProperty(responseHeaders, "Connection", "close");
+		sendErrorResponse(conn, 405, "Method Not Allowed", responseHeaders);
 		return;
 	}
 
-	// ensure content length is specified in the request header
-	char buf[MAXBUF];
-	if (findProperty(requestHeaders, 0, "Content-Length", buf) == SIZE_MAX) {
-		sendErrorResponse(stream, 411, "Length Required", responseHeaders);
-	} else {
-		copyFileStreamBytes(stream, postStream, atoi(buf));
+	bool received = receiveBody(conn, postFd, contentLength, responseHeaders);
+	close(postFd);
+	if (!received) {
+		return;
 	}
-	fclose(postStream);
-
-	sendResponseStatus(stream, 200, "OK");
 
-	sendResponseHeaders(stream, responseHeaders);
+	putProperty(responseHeaders, "Content-Length", "0");
+	sendResponse(conn, 200, "OK", responseHeaders, NULL, 0);
 }
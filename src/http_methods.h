@@ -11,58 +11,54 @@
 #ifndef HTTP_METHODS_H_
 #define HTTP_METHODS_H_
 
-#include <stdio.h>
 #include "properties.h"
 
+struct connection;
+
 /**
  * Handle HEAD request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_get(struct connection *conn, const char *uri, Properties *responseHeaders);
 
 /**
  * Handle HEAD request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_head(struct connection *conn, const char *uri, Properties *responseHeaders);
 
 /**
  * Handle DELETE request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_delete(struct connection *conn, const char *uri, Properties *responseHeaders);
 
 /**
  * Handle PUT request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_put(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_put(struct connection *conn, const char *uri, Properties *responseHeaders);
 
 /**
  * Handle POST request.
  *
- * @param the socket stream
+ * @param conn the client connection
  * @param uri the request URI
- * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_post(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_post(struct connection *conn, const char *uri, Properties *responseHeaders);
 
 
 #endif /* HTTP_METHODS_H_ */
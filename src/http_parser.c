@@ -0,0 +1,495 @@
+/*
+ * http_parser.c
+ *
+ * Incremental parser for the request line and headers. It works
+ * in place on the connection receive buffer, producing slices of
+ * the buffer rather than copies, and resumes where it left off
+ * when more bytes arrive.
+ *
+ *  @since 2020-04-22
+ */
+#include <stdbool.h>
+
+#include "http_parser.h"
+#include "simd_util.h"
+
+/** parser states */
+enum {
+	PARSE_START,         // empty lines before the request line
+	PARSE_METHOD,
+	PARSE_URI_START,     // spaces before the URI
+	PARSE_URI,
+	PARSE_VERSION_START, // spaces before the version
+	PARSE_VERSION,
+	PARSE_LINE_LF,       // LF after CR ending a line
+	PARSE_HEADER_START,  // header line or blank line
+	PARSE_HEADER_NAME,
+	PARSE_VALUE_START,   // whitespace before the value
+	PARSE_VALUE,
+	PARSE_HEAD_LF,       // LF after CR of the blank line
+	PARSE_DONE,
+	PARSE_ERROR,
+	PARSE_TOO_LARGE
+};
+
+/** names of the recognized headers, by id */
+static const char *const header_names[HTTP_HEADER_COUNT] = {
+	[HTTP_HEADER_ACCEPT] = "Accept",
+	[HTTP_HEADER_ACCEPT_ENCODING] = "Accept-Encoding",
+	[HTTP_HEADER_CONNECTION] = "Connection",
+	[HTTP_HEADER_CONTENT_LENGTH] = "Content-Length",
+	[HTTP_HEADER_CONTENT_TYPE] = "Content-Type",
+	[HTTP_HEADER_COOKIE] = "Cookie",
+	[HTTP_HEADER_EXPECT] = "Expect",
+	[HTTP_HEADER_HOST] = "Host",
+	[HTTP_HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+	[HTTP_HEADER_IF_NONE_MATCH] = "If-None-Match",
+	[HTTP_HEADER_IF_RANGE] = "If-Range",
+	[HTTP_HEADER_RANGE] = "Range",
+	[HTTP_HEADER_TRANSFER_ENCODING] = "Transfer-Encoding",
+	[HTTP_HEADER_USER_AGENT] = "User-Agent"
+};
+
+/**
+ * Determine whether a byte may appear in a method or header name.
+ *
+ * @param c the byte
+ * @return true if c is a token character
+ */
+static bool is_token_char(unsigned char c) {
+	switch (c) {
+	case '"': case '(': case ')': case ',': case '/': case ':': case ';':
+	case '<': case '=': case '>': case '?': case '@': case '[': case '\\':
+	case ']': case '{': case '}':
+		return false;
+	default:
+		return (c > ' ') && (c < 0x7f);
+	}
+}
+
+/**
+ * Determine whether a byte is a control character other than tab.
+ *
+ * @param c the byte
+ * @return true if c is not allowed in a URI, version or value
+ */
+static bool is_ctl(unsigned char c) {
+	return ((c < ' ') && (c != '\t')) || (c == 0x7f);
+}
+
+/**
+ * Identify a request method. Methods are matched ignoring case.
+ *
+ * @param name the method name
+ * @param len the length of the name
+ * @return the method, or HTTP_METHOD_OTHER if not recognized
+ */
+static enum http_method parse_method(const char *name, size_t len) {
+	switch (len) {
+	case 3:
+		if (str_caseeq(name, "GET", 3)) {
+			return HTTP_METHOD_GET;
+		} else if (str_caseeq(name, "PUT", 3)) {
+			return HTTP_METHOD_PUT;
+		}
+		break;
+	case 4:
+		if (str_caseeq(name, "HEAD", 4)) {
+			return HTTP_METHOD_HEAD;
+		} else if (str_caseeq(name, "POST", 4)) {
+			return HTTP_METHOD_POST;
+		}
+		break;
+	case 6:
+		if (str_caseeq(name, "DELETE", 6)) {
+			return HTTP_METHOD_DELETE;
+		}
+		break;
+	}
+	return HTTP_METHOD_OTHER;
+}
+
+/**
+ * Check whether a header name is a recognized header.
+ *
+ * @param name the header name
+ * @param len the length of the name
+ * @param id the recognized header to check for
+ * @return id if the name matches ignoring case, otherwise HTTP_HEADER_COUNT
+ */
+static enum http_header_id match_header(const char *name, size_t len, enum http_header_id id) {
+	return str_caseeq(name, header_names[id], len) ? id : HTTP_HEADER_COUNT;
+}
+
+/**
+ * Identify a recognized header. The length selects the one or
+ * two candidates, so only those are compared.
+ *
+ * @param name the header name
+ * @param len the length of the name
+ * @return the header id, or HTTP_HEADER_COUNT if not recognized
+ */
+static enum http_header_id parse_header_id(const char *name, size_t len) {
+	switch (len) {
+	case 4:
+		return match_header(name, len, HTTP_HEADER_HOST);
+	case 5:
+		return match_header(name, len, HTTP_HEADER_RANGE);
+	case 6:
+		switch (name[0] | 0x20) {
+		case 'a':
+			return match_header(name, len, HTTP_HEADER_ACCEPT);
+		case 'c':
+			return match_header(name, len, HTTP_HEADER_COOKIE);
+		case 'e':
+			return match_header(name, len, HTTP_HEADER_EXPECT);
+		}
+		break;
+	case 8:
+		return match_header(name, len, HTTP_HEADER_IF_RANGE);
+	case 10:
+		switch (name[0] | 0x20) {
+		case 'c':
+			return match_header(name, len, HTTP_HEADER_CONNECTION);
+		case 'u':
+			return match_header(name, len, HTTP_HEADER_USER_AGENT);
+		}
+		break;
+	case 12:
+		return match_header(name, len, HTTP_HEADER_CONTENT_TYPE);
+	case 13:
+		return match_header(name, len, HTTP_HEADER_IF_NONE_MATCH);
+	case 14:
+		return match_header(name, len, HTTP_HEADER_CONTENT_LENGTH);
+	case 15:
+		return match_header(name, len, HTTP_HEADER_ACCEPT_ENCODING);
+	case 17:
+		switch (name[0] | 0x20) {
+		case 'i':
+			return match_header(name, len, HTTP_HEADER_IF_MODIFIED_SINCE);
+		case 't':
+			return match_header(name, len, HTTP_HEADER_TRANSFER_ENCODING);
+		}
+		break;
+	}
+	return HTTP_HEADER_COUNT;
+}
+
+/**
+ * Parse a Content-Length value of decimal digits.
+ *
+ * @param value the value
+ * @param len the length of the value
+ * @param length returns the content length
+ * @return true if the value is a valid length
+ */
+static bool parse_content_length(const char *value, size_t len, uint64_t *length) {
+	if (len == 0) {
+		return false;
+	}
+	uint64_t n = 0;
+	for (size_t i = 0; i < len; i++) {
+		unsigned d = (unsigned char)value[i] - '0';
+		if ((d > 9) || (n > (uint64_t)(INT64_MAX - d) / 10)) {  // also fits in an off_t
+			return false;
+		}
+		n = n * 10 + d;
+	}
+	*length = n;
+	return true;
+}
+
+/**
+ * Parse the comma-separated options of a Connection value.
+ * Options other than close and keep-alive are ignored.
+ *
+ * @param value the value
+ * @param len the length of the value
+ * @return the HTTP_CONNECTION_* options
+ */
+static unsigned parse_connection(const char *value, size_t len) {
+	unsigned options = 0;
+	size_t i = 0;
+	while (i < len) {
+		size_t start = i + str_find_any(value + i, len - i, ",");
+		size_t end = start;
+		while ((i < start) && ((value[i] == ' ') || (value[i] == '\t'))) {
+			i++;
+		}
+		while ((end > i) && ((value[end - 1] == ' ') || (value[end - 1] == '\t'))) {
+			end--;
+		}
+		if ((end - i == 5) && str_caseeq(value + i, "close", 5)) {
+			options |= HTTP_CONNECTION_CLOSE;
+		} else if ((end - i == 10) && str_caseeq(value + i, "keep-alive", 10)) {
+			options |= HTTP_CONNECTION_KEEP_ALIVE;
+		}
+		i = start + 1;
+	}
+	return options;
+}
+
+/**
+ * Store a complete header: recognized headers by id with their
+ * values parsed, and others in the list of headers. A repeated
+ * recognized header goes to the list, except that a repeated
+ * Content-Length must have the same value.
+ *
+ * @param parser the parser
+ * @param buf the request bytes
+ * @param value the header value
+ * @return false if the value is invalid
+ */
+static bool end_header(struct http_parser *parser, const char *buf, struct http_slice value) {
+	enum http_header_id id = parser->header_id;
+	if (id == HTTP_HEADER_CONTENT_LENGTH) {
+		uint64_t length;
+		if (!parse_content_length(buf + value.off, value.len, &length)) {
+			return false;
+		} else if ((parser->known & (1u << id)) && (length != parser->content_length)) {
+			return false;
+		}
+		parser->content_length = length;
+	}
+	if ((id == HTTP_HEADER_COUNT) || (parser->known & (1u << id))) {
+		parser->headers[parser->nheaders++].value = value;
+		return true;
+	}
+	if (id == HTTP_HEADER_CONNECTION) {
+		parser->connection = parse_connection(buf + value.off, value.len);
+	}
+	parser->known |= 1u << id;
+	parser->values[id] = value;
+	return true;
+}
+
+/**
+ * Initialize a parser to parse a new request.
+ *
+ * @param parser the parser
+ */
+void http_parser_init(struct http_parser *parser) {
+	parser->state = PARSE_START;
+	parser->pos = 0;
+	parser->mark = 0;
+	parser->vend = 0;
+	parser->method = HTTP_METHOD_OTHER;
+	parser->content_length = HTTP_NO_CONTENT_LENGTH;
+	parser->connection = 0;
+	parser->known = 0;
+	parser->nheaders = 0;
+}
+
+/**
+ * Get the status of a parser that has stopped.
+ *
+ * @param parser the parser
+ * @return the parse status
+ */
+static enum http_parse_status parse_status(const struct http_parser *parser) {
+	switch (parser->state) {
+	case PARSE_DONE:
+		return HTTP_PARSE_DONE;
+	case PARSE_ERROR:
+		return HTTP_PARSE_ERROR;
+	case PARSE_TOO_LARGE:
+		return HTTP_PARSE_TOO_LARGE;
+	default:
+		return HTTP_PARSE_INCOMPLETE;
+	}
+}
+
+/**
+ * Parse the request line and headers at the start of a buffer,
+ * resuming where the previous call left off. Empty lines before
+ * the request line are skipped, and header lines without a colon
+ * are ignored. Recognized headers are stored by id, with their
+ * Content-Length and Connection values parsed; the first of
+ * repeated headers is used.
+ *
+ * @param parser the parser
+ * @param buf the request bytes received so far
+ * @param len the number of bytes received
+ * @return the parse status
+ */
+enum http_parse_status http_parse(struct http_parser *parser, const char *buf, size_t len) {
+	size_t i;
+	for (i = parser->pos; (i < len) && (parser->state < PARSE_DONE); i++) {
+		// skip runs of URI and value bytes rather than examining each one
+		if (parser->state == PARSE_URI) {
+			i += str_span_text(buf + i, len - i, '!');
+		} else if (parser->state == PARSE_VALUE) {
+			size_t run = str_span_text(buf + i, len - i, ' ');
+			size_t end = i + run;
+			while ((end > i) && (buf[end - 1] == ' ')) {
+				end--;
+			}
+			if (end > i) {
+				parser->vend = end;
+			}
+			i += run;
+		}
+		if (i == len) {
+			break;
+		}
+		unsigned char c = buf[i];
+		switch (parser->state) {
+		case PARSE_START:
+			if ((c == '\r') || (c == '\n')) {
+				break;
+			}
+			parser->mark = i;
+			parser->state = PARSE_METHOD;
+			// fall through
+		case PARSE_METHOD:
+			if (c == ' ') {
+				parser->method_name.off = parser->mark;
+				parser->method_name.len = i - parser->mark;
+				parser->method = parse_method(buf + parser->mark, i - parser->mark);
+				parser->state = PARSE_URI_START;
+			} else if (!is_token_char(c)) {
+				parser->state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_URI_START:
+			if (c == ' ') {
+				break;
+			}
+			parser->mark = i;
+			parser->state = PARSE_URI;
+			// fall through
+		case PARSE_URI:
+			if (c == ' ') {
+				parser->uri.off = parser->mark;
+				parser->uri.len = i - parser->mark;
+				parser->state = PARSE_VERSION_START;
+			} else if ((c <= ' ') || (c == 0x7f)) {  // includes a line without a version
+				parser->state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_VERSION_START:
+			if (c == ' ') {
+				break;
+			}
+			parser->mark = i;
+			parser->state = PARSE_VERSION;
+			// fall through
+		case PARSE_VERSION:
+			if ((c == '\r') || (c == '\n')) {
+				if (i == parser->mark) {
+					parser->state = PARSE_ERROR;
+					break;
+				}
+				parser->version.off = parser->mark;
+				parser->version.len = i - parser->mark;
+				parser->state = (c == '\r') ? PARSE_LINE_LF : PARSE_HEADER_START;
+			} else if ((c <= ' ') || (c == 0x7f)) {
+				parser->state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_LINE_LF:
+			parser->state = (c == '\n') ? PARSE_HEADER_START : PARSE_ERROR;
+			break;
+		case PARSE_HEADER_START:
+			if (c == '\r') {
+				parser->state = PARSE_HEAD_LF;
+				break;
+			} else if (c == '\n') {
+				parser->state = PARSE_DONE;
+				break;
+			} else if (parser->nheaders == HTTP_MAX_HEADERS) {
+				parser->state = PARSE_TOO_LARGE;
+				break;
+			}
+			parser->mark = i;
+			parser->state = PARSE_HEADER_NAME;
+			// fall through
+		case PARSE_HEADER_NAME:
+			if (c == ':') {
+				if (i == parser->mark) {
+					parser->state = PARSE_ERROR;
+					break;
+				}
+				struct http_header *header = &parser->headers[parser->nheaders];
+				header->name.off = parser->mark;
+				header->name.len = i - parser->mark;
+				parser->header_id = parse_header_id(buf + parser->mark, i - parser->mark);
+				parser->state = PARSE_VALUE_START;
+			} else if (c == '\r') {  // line without a colon is ignored
+				parser->state = PARSE_LINE_LF;
+			} else if (c == '\n') {
+				parser->state = PARSE_HEADER_START;
+			} else if (!is_token_char(c)) {
+				parser->state = PARSE_ERROR;
+			}
+			break;
+		case PARSE_VALUE_START:
+			if ((c == ' ') || (c == '\t')) {
+				break;
+			}
+			parser->mark = parser->vend = i;
+			parser->state = PARSE_VALUE;
+			// fall through
+		case PARSE_VALUE:
+			if ((c == '\r') || (c == '\n')) {
+				struct http_slice value = {parser->mark, parser->vend - parser->mark};
+				if (!end_header(parser, buf, value)) {
+					parser->state = PARSE_ERROR;
+					break;
+				}
+				parser->state = (c == '\r') ? PARSE_LINE_LF : PARSE_HEADER_START;
+			} else if (is_ctl(c)) {
+				parser->state = PARSE_ERROR;
+			} else if ((c != ' ') && (c != '\t')) {
+				parser->vend = i + 1;
+			}
+			break;
+		case PARSE_HEAD_LF:
+			parser->state = (c == '\n') ? PARSE_DONE : PARSE_ERROR;
+			break;
+		}
+	}
+	parser->pos = i;
+	return parse_status(parser);
+}
+
+/**
+ * Get the method and recognized headers of a parsed request.
+ * Header values are terminated in place.
+ *
+ * @param parser the parser
+ * @param buf the request bytes
+ * @param request the request
+ */
+void http_parser_request(const struct http_parser *parser, char *buf, struct http_request *request) {
+	request->method = parser->method;
+	request->content_length = parser->content_length;
+	request->connection = parser->connection;
+	for (int id = 0; id < HTTP_HEADER_COUNT; id++) {
+		request->headers[id] = (parser->known & (1u << id)) ? http_slice_str(buf, parser->values[id]) : NULL;
+	}
+}
+
+/**
+ * Get the name of a recognized header.
+ *
+ * @param id the header id
+ * @return the header name
+ */
+const char *http_header_name(enum http_header_id id) {
+	return header_names[id];
+}
+
+/**
+ * Terminate a slice in place and return it as a string. The
+ * byte after every slice is a delimiter that is overwritten,
+ * so the request bytes can no longer be parsed.
+ *
+ * @param buf the request bytes
+ * @param slice the slice
+ * @return the slice as a string
+ */
+char *http_slice_str(char *buf, struct http_slice slice) {
+	buf[slice.off + slice.len] = '\0';
+	return buf + slice.off;
+}
@@ -0,0 +1,208 @@
+/*
+ * http_parser.h
+ *
+ * Incremental parser for the request line and headers. It works
+ * in place on the connection receive buffer, producing slices of
+ * the buffer rather than copies, and resumes where it left off
+ * when more bytes arrive.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef HTTP_PARSER_H_
+#define HTTP_PARSER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** maximum number of unrecognized request headers */
+#define HTTP_MAX_HEADERS 100
+
+/** Content-Length of a request without one */
+#define HTTP_NO_CONTENT_LENGTH UINT64_MAX
+
+/** Connection header options */
+#define HTTP_CONNECTION_CLOSE 0x1
+#define HTTP_CONNECTION_KEEP_ALIVE 0x2
+
+/** request methods recognized by the parser */
+enum http_method {
+	HTTP_METHOD_OTHER,
+	HTTP_METHOD_GET,
+	HTTP_METHOD_HEAD,
+	HTTP_METHOD_PUT,
+	HTTP_METHOD_POST,
+	HTTP_METHOD_DELETE
+};
+
+/** request headers recognized by the parser */
+enum http_header_id {
+	HTTP_HEADER_ACCEPT,
+	HTTP_HEADER_ACCEPT_ENCODING,
+	HTTP_HEADER_CONNECTION,
+	HTTP_HEADER_CONTENT_LENGTH,
+	HTTP_HEADER_CONTENT_TYPE,
+	HTTP_HEADER_COOKIE,
+	HTTP_HEADER_EXPECT,
+	HTTP_HEADER_HOST,
+	HTTP_HEADER_IF_MODIFIED_SINCE,
+	HTTP_HEADER_IF_NONE_MATCH,
+	HTTP_HEADER_IF_RANGE,
+	HTTP_HEADER_RANGE,
+	HTTP_HEADER_TRANSFER_ENCODING,
+	HTTP_HEADER_USER_AGENT,
+	/** number of recognized headers, and id of other headers */
+	HTTP_HEADER_COUNT
+};
+
+/** result of parsing */
+enum http_parse_status {
+	/** more bytes are needed */
+	HTTP_PARSE_INCOMPLETE,
+	/** request line and headers are complete */
+	HTTP_PARSE_DONE,
+	/** request line or headers are malformed */
+	HTTP_PARSE_ERROR,
+	/** request has too many headers */
+	HTTP_PARSE_TOO_LARGE
+};
+
+/**
+ * A run of bytes in the request, as an offset from the start
+ * of the request so it survives the buffer moving or growing.
+ */
+struct http_slice {
+	/** offset of the first byte from the start of the request */
+	size_t off;
+
+	/** number of bytes */
+	size_t len;
+};
+
+/** a request header */
+struct http_header {
+	/** header name */
+	struct http_slice name;
+
+	/** header value without surrounding whitespace */
+	struct http_slice value;
+};
+
+/**
+ * Method and headers of a parsed request. Header values are
+ * valid until the request body is read from the connection.
+ */
+struct http_request {
+	/** request method */
+	enum http_method method;
+
+	/** value of the Content-Length header, or HTTP_NO_CONTENT_LENGTH if none */
+	uint64_t content_length;
+
+	/** HTTP_CONNECTION_* options of the Connection header */
+	unsigned connection;
+
+	/** values of the recognized headers, or NULL if absent */
+	const char *headers[HTTP_HEADER_COUNT];
+};
+
+/** parser state and the parts of the request parsed so far */
+struct http_parser {
+	/** current state of the parser */
+	int state;
+
+	/** offset of the next byte to parse; the head length once done */
+	size_t pos;
+
+	/** offset of the start of the token being parsed */
+	size_t mark;
+
+	/** offset after the last non-whitespace byte of the value being parsed */
+	size_t vend;
+
+	/** id of the header being parsed */
+	enum http_header_id header_id;
+
+	/** request method */
+	enum http_method method;
+
+	/** value of the Content-Length header, or HTTP_NO_CONTENT_LENGTH if none */
+	uint64_t content_length;
+
+	/** HTTP_CONNECTION_* options of the Connection header */
+	unsigned connection;
+
+	/** bit set of the recognized headers present */
+	unsigned known;
+
+	/** values of the recognized headers present */
+	struct http_slice values[HTTP_HEADER_COUNT];
+
+	/** request method name */
+	struct http_slice method_name;
+
+	/** request URI including any query */
+	struct http_slice uri;
+
+	/** request protocol version */
+	struct http_slice version;
+
+	/** number of unrecognized request headers */
+	int nheaders;
+
+	/** unrecognized request headers, and repeats of recognized ones, in the order received */
+	struct http_header headers[HTTP_MAX_HEADERS];
+};
+
+/**
+ * Initialize a parser to parse a new request.
+ *
+ * @param parser the parser
+ */
+void http_parser_init(struct http_parser *parser);
+
+/**
+ * Parse the request line and headers at the start of a buffer,
+ * resuming where the previous call left off. Empty lines before
+ * the request line are skipped, and header lines without a colon
+ * are ignored. Recognized headers are stored by id, with their
+ * Content-Length and Connection values parsed; the first of
+ * repeated headers is used.
+ *
+ * @param parser the parser
+ * @param buf the request bytes received so far
+ * @param len the number of bytes received
+ * @return the parse status
+ */
+enum http_parse_status http_parse(struct http_parser *parser, const char *buf, size_t len);
+
+/**
+ * Get the method and recognized headers of a parsed request.
+ * Header values are terminated in place.
+ *
+ * @param parser the parser
+ * @param buf the request bytes
+ * @param request the request
+ */
+void http_parser_request(const struct http_parser *parser, char *buf, struct http_request *request);
+
+/**
+ * Get the name of a recognized header.
+ *
+ * @param id the header id
+ * @return the header name
+ */
+const char *http_header_name(enum http_header_id id);
+
+/**
+ * Terminate a slice in place and return it as a string. The
+ * byte after every slice is a delimiter that is overwritten,
+ * so the request bytes can no longer be parsed.
+ *
+ * @param buf the request bytes
+ * @param slice the slice
+ * @return the slice as a string
+ */
+char *http_slice_str(char *buf, struct http_slice slice);
+
+#endif /* HTTP_PARSER_H_ */
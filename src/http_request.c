@@ -6,117 +6,251 @@
  *  @since 2019-04-10
  *  @author: Philip Gust
  */
+#define _GNU_SOURCE
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/param.h>
 #include "http_methods.h"
 #include "http_util.h"
 #include "string_util.h"
+#include "simd_util.h"
 #include "time_util.h"
 #include "http_server.h"
+#include "event_loop.h"
+#include "coroutine.h"
+#include "scheduler.h"
 
 
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ * Determine whether the connection should be kept open after
+ * responding to this request, based on the request protocol
+ * version and "Connection" header, the number of requests
+ * already made on the connection, and whether the server is
+ * draining its connections to stop. A request body that no
+ * handler reads is never left to be parsed as the next request.
+ *
+ * @param conn the client connection
+ * @param version the request protocol version
+ * @param request the request
+ * @return true if connection should be kept alive
  */
-void process_request(int sock_fd) {
-	char buf[MAXBUF];
-	char request[MAXBUF];
-	char method[MAXBUF];
-	char uri[MAXBUF], encUri[MAXBUF];
-	char version[MAXBUF];
-
-	// open socket as a stream
-	FILE *stream = fdopen(sock_fd, "r+");
-	if (stream == NULL) {
-		perror("fdopen");
-		return;
+static bool request_keep_alive(struct connection *conn, const char *version, const struct http_request *request) {
+	if (server.keep_alive_max == 0 || conn->nrequests >= server.keep_alive_max
+			|| __atomic_load_n(&server.draining, __ATOMIC_RELAXED)) {
+		return false;
+	}
+	// only PUT and POST read a body, and only by its Content-Length
+	if (request->headers[HTTP_HEADER_TRANSFER_ENCODING] != NULL) {
+		return false;
+	}
+	if (request->content_length != HTTP_NO_CONTENT_LENGTH && request->content_length > 0
+			&& request->method != HTTP_METHOD_PUT && request->method != HTTP_METHOD_POST) {
+		return false;
+	}
+	// HTTP/1.1 connections are persistent unless the client closes
+	bool keepAlive = (strlen(version) == 8) && str_caseeq(version, "HTTP/1.1", 8);
+	if (request->connection & HTTP_CONNECTION_CLOSE) {
+		keepAlive = false;
+	} else if (request->connection & HTTP_CONNECTION_KEEP_ALIVE) {
+		keepAlive = true;
 	}
-	// turn off buffering to also allow direct use of socket
-	setvbuf(stream, NULL, _IONBF, 0);
+	return keepAlive;
+}
 
-	// get header line
-	if (fgets(request, MAXBUF, stream) == NULL) {
-		return;
+/**
+ *  Process an http request. The response is left in the
+ *  connection response buffer until conn_flush() is called.
+ *  @param conn the client connection
+ *  @return true if the connection should be kept open for another request
+ */
+bool process_request(struct connection *conn) {
+	char buf[MAXBUF];
+	char uri[MAXPATHLEN];
+
+	// parse request line and headers in the receive buffer
+	enum http_parse_status parsed = conn_read_request(conn);
+	if (parsed == HTTP_PARSE_INCOMPLETE) {
+		return false;
 	}
-	// eliminate newline from request
-	trim_newline(request);
+	conn->nrequests++;
+
+	// header storage of the previous request is reused
+	arena_reset(&conn->arena);
 
-	// initialize request headers
-	Properties *responseHeaders = newProperties();
+	// initialize response headers
+	Properties *responseHeaders = newArenaProperties(&conn->arena);
 	// name of server
 	putProperty(responseHeaders, "Server", server.server_name);
 
 	// date and time of this response
-	time_t timer;
-	time(&timer); // need to get local file time?
-	putProperty(responseHeaders,"Date",
-				milliTimeToRFC_1123_Date_Time(timer, buf));
+	putProperty(responseHeaders,"Date", currentRFC_1123_Date_Time());
 
-
-	// decode header
-	if (sscanf(request, "%s %s %s", method, encUri, version) != 3) {
+	// reject malformed requests, and those that do not fit the buffers
+	struct http_parser *parser = &conn->parser;
+	int status = 0;
+	const char *statusMsg = NULL;
+	if (parsed == HTTP_PARSE_TOO_LARGE) {
+		status = 431;
+		statusMsg = "Request Header Fields Too Large";
+	} else if (parsed != HTTP_PARSE_DONE) {
+		status = 400;
+		statusMsg = "Bad Request";
+	} else if (parser->uri.len + strlen(server.content_base) >= sizeof(uri)) {
+		status = 414;
+		statusMsg = "URI Too Long";
+	}
+	if (status != 0) {
 		if (server.debug) {
-			fprintf(stderr, "request header incomplete: %s\n", request);
+			fprintf(stderr, "request header invalid: %d %s\n", status, statusMsg);
 		}
-		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
-		return;
+		putProperty(responseHeaders, "Connection", "close");
+		sendErrorResponse(conn, status, statusMsg, responseHeaders);
+		deleteProperties(responseHeaders);
+		return false;
 	}
-	// initialize request headers
-	Properties *requestHeaders = newProperties();
-	readRequestHeaders(stream, requestHeaders);
+
+	// terminate parsed request fields in place in the receive buffer
+	char *head = conn->rbuf + conn->rpos;
+	struct http_request *request = &conn->request;
+	http_parser_request(parser, head, request);
+	const char *methodName = http_slice_str(head, parser->method_name);
+	char *encUri = http_slice_str(head, parser->uri);
+	const char *version = http_slice_str(head, parser->version);
 	if (server.debug) {
-		debugRequest(request, requestHeaders);
+		// handlers use only the recognized headers; the others are printed
+		Properties *requestHeaders = newArenaProperties(&conn->arena);
+		for (int i = 0; i < parser->nheaders; i++) {
+			putProperty(requestHeaders, http_slice_str(head, parser->headers[i].name),
+						http_slice_str(head, parser->headers[i].value));
+		}
+		char requestLine[MAXBUF];
+		snprintf(requestLine, sizeof(requestLine), "%s %s %s", methodName, encUri, version);
+		debugRequest(requestLine, request, requestHeaders);
+		deleteProperties(requestHeaders);
+	}
+
+	// tell client whether connection remains open; handlers may
+	// close it if they do not consume the request body
+	if (request_keep_alive(conn, version, request)) {
+		putProperty(responseHeaders, "Connection", "keep-alive");
+		sprintf(buf, "timeout=%d, max=%u", server.keep_alive_timeout,
+				server.keep_alive_max - conn->nrequests);
+		putProperty(responseHeaders, "Keep-Alive", buf);
+	} else {
+		putProperty(responseHeaders, "Connection", "close");
 	}
 
-	// save query parameters as key "?"
-	char *p = strpbrk(encUri,"?&");
-	if (p != NULL) {
-		putProperty(requestHeaders, "?", p+1);
-		*p = '\0';
+	// query parameters are not used to resolve the URI
+	size_t query = str_find_any(encUri, parser->uri.len, "?&");
+	if (query < parser->uri.len) {
+		encUri[query] = '\0';
 	}
 
-	// unescape URI
-	if (unescapeUri(encUri, uri) == NULL) {
+	// unescape URI; the request body follows the parsed bytes
+	bool validUri = (unescapeUri(encUri, uri) != NULL);
+	conn_request_consume(conn);
+	if (!validUri) {
 		if (server.debug) {
-			fprintf(stderr, "request header invalid URI encoding %s\n", request);
+			fprintf(stderr, "request header invalid URI encoding %s\n", encUri);
+		}
+		setProperty(responseHeaders, "Connection", "close");
+		sendErrorResponse(conn, 400, "Bad Request", responseHeaders);
+	} else {
+		switch (request->method) {  // dispatch based on method
+		case HTTP_METHOD_GET:
+			do_get(conn, uri, responseHeaders);
+			break;
+		case HTTP_METHOD_HEAD:
+			do_head(conn, uri, responseHeaders);
+			break;
+		case HTTP_METHOD_DELETE:
+			do_delete(conn, uri, responseHeaders);
+			break;
+		case HTTP_METHOD_PUT:
+			do_put(conn, uri, responseHeaders);
+			break;
+		case HTTP_METHOD_POST:
+			do_post(conn, uri, responseHeaders);
+			break;
+		default:
+			setProperty(responseHeaders, "Connection", "close");
+			sendErrorResponse(conn, 501, "Not Implemented", responseHeaders);
+			break;
 		}
-		sendErrorResponse(stream, 400, "Bad Request", responseHeaders);
-		return;
 	}
 
-	// dispatch based on method
-	if (strcasecmp(method, "GET") == 0) {
-		do_get(stream, uri, requestHeaders, responseHeaders);
-	} else 	if (strcasecmp(method, "HEAD") == 0) {
-		do_head(stream, uri, requestHeaders, responseHeaders);
-	} else 	if (strcasecmp(method, "DELETE") == 0) {
-        do_delete(stream, uri, requestHeaders, responseHeaders);
-    } else  if (strcasecmp(method, "PUT") == 0) {
-        do_put(stream, uri, requestHeaders, responseHeaders);
-    } else  if (strcasecmp(method, "POST") == 0) {
-        do_post(stream, uri, requestHeaders, responseHeaders);
-    } else {
-		sendErrorResponse(stream, 501, "Not Implemented", responseHeaders);
-	}
+	// response stays in the connection buffer so that responses
+	// to pipelined requests are sent together by the caller
+
+	// keep connection open only if response said so and was sent
+	const char *connection = findPropertyValue(responseHeaders, "Connection");
+	bool keepAlive = !conn->error
+			&& (connection != NULL)
+			&& (strcasecmp(connection, "keep-alive") == 0);
 
 	// delete headers
-	deleteProperties(requestHeaders);
 	deleteProperties(responseHeaders);
 
-	// close socket stream
-	fflush(stream);
-	fclose(stream);
-	close(sock_fd);
+	return keepAlive;
+}
+
+/**
+ * Process the requests on a connection dispatched by the event
+ * loop. Pipelined requests that are already buffered are processed
+ * together, and their responses are sent with one write; then a
+ * persistent connection is returned to the event loop to wait for
+ * the next request.
+ * @param conn - the void pointer to the client connection
+ */
+static void serve_connection(void* conn) {
+	struct connection *c = conn;
+	bool keepAlive;
+	do {
+		keepAlive = process_request(c);
+	} while (keepAlive && conn_request_ready(c));
+
+	// send responses to all pipelined requests together
+	if (conn_flush(c) != 0) {
+		keepAlive = false;
+	}
+
+	// connection is no longer served by this coroutine
+	c->co = NULL;
+	if (keepAlive) {
+		event_loop_resume(c);
+	} else {
+		event_loop_close(c);
+	}
 }
 
 /**
- * Reversing the cast from void* to int.
- * @param socket_fd - the void pointer casted from int socket_fd
+ * Scheduler work function that serves a connection dispatched by
+ * the event loop, or resumes serving it once the socket is ready.
+ * Requests are served by a coroutine that yields the worker while
+ * waiting for the socket, and that is always resumed by the same
+ * worker. A worker serves requests without a coroutine if it has
+ * as many coroutines as its queue for resuming them can hold.
+ * @param conn - the void pointer to the client connection
  */
-void param_adapter(void* socket_fd) {
-    process_request((int) (uintptr_t) socket_fd);
-}
\ No newline at end of file
+void param_adapter(void* conn) {
+	struct connection *c = conn;
+	if (c->co == NULL && coro_count() < SCHEDULER_QUEUE_CAPACITY) {
+		c->worker = scheduler_worker_id();
+		if (c->worker >= 0) {
+			c->co = coro_new(serve_connection, c);
+		}
+	}
+
+	conn_set_current(c);
+	if (c->co != NULL) {
+		// connection may be resumed elsewhere or deleted once this returns
+		coro_resume(c->co);
+	} else {
+		serve_connection(c);
+	}
+	conn_set_current(NULL);
+}
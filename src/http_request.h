@@ -10,16 +10,26 @@
 #ifndef HTTP_REQUEST_H_
 #define HTTP_REQUEST_H_
 
+#include <stdbool.h>
+#include "connection.h"
+
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ *  Process an http request. The response is left in the
+ *  connection response buffer until conn_flush() is called.
+ *  @param conn the client connection
+ *  @return true if the connection should be kept open for another request
  */
-void process_request(int sock_fd);
+bool process_request(struct connection *conn);
 
 /**
- * Reversing the cast from void* to int.
- * @param socket_fd - the void pointer casted from int socket_fd
+ * Scheduler work function that serves a connection dispatched by
+ * the event loop, or resumes serving it once the socket is ready.
+ * Requests are served by a coroutine that yields the worker while
+ * waiting for the socket, and that is always resumed by the same
+ * worker. A worker serves requests without a coroutine if it has
+ * as many coroutines as its queue for resuming them can hold.
+ * @param conn - the void pointer to the client connection
  */
-void param_adapter(void* socket_fd);
+void param_adapter(void* conn);
 
 #endif /* HTTP_REQUEST_H_ */
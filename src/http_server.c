@@ -2,11 +2,12 @@
  * http_server.c
  *
  * The HTTP server main function sets up the listener socket
- * and dispatches client requests to request sockets.
+ * and runs the event loop that dispatches client requests.
  *
  *  @since 2019-04-10
  *  @author: Philip Gust
  */
+#include <signal.h>
 #include <stdbool.h>
 #include <netdb.h>
 #include <stdio.h>
@@ -14,6 +15,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/param.h>
 
 #include "http_methods.h"
 #include "time_util.h"
@@ -22,9 +24,12 @@
 #include "network_util.h"
 #include "properties.h"
 #include "http_server.h"
-#include "thpool.h"
 #include "media_util.h"
 #include "file_util.h"
+#include "uring.h"
+#include "shard.h"
+#include "restart.h"
+#include "simd_util.h"
 
 /**
  * The port numbers come from wikipedia and they are registered ports.
@@ -35,10 +40,45 @@
 
 #define DEFAULT_HTTP_PORT 8080
 
+#define DEFAULT_THREADS 16
+
+#define DEFAULT_KEEP_ALIVE_MAX 100
+
+#define DEFAULT_KEEP_ALIVE_TIMEOUT 5
+
+#define DEFAULT_HEADER_TIMEOUT 20
+
+#define DEFAULT_BODY_TIMEOUT 20
+
+#define DEFAULT_REQUEST_TIMEOUT 60
+
+#define DEFAULT_ADMISSION_LATENCY 50
+
+#define DEFAULT_RETRY_AFTER 1
+
+#define DEFAULT_DRAIN_TIMEOUT 30
+
 /** http server configuration */
 struct http_server_conf server;
 
 
+/**
+ * Copy the value of a configuration property to storage
+ * that outlives the configuration.
+ * @param httpConfig the configuration properties
+ * @param name the property name
+ * @param val storage for the value, of at least MAX_PROP_VAL bytes
+ * @return true if the property was found
+ */
+static bool copyProperty(const Properties *httpConfig, const char *name, char *val) {
+	PropertyView view;
+	if (findPropertyView(httpConfig, 0, name, &view) == SIZE_MAX) {
+		return false;
+	}
+	memcpy(val, view.val, view.valLen+1);
+	return true;
+}
+
 /**
  * Process the server configuration file
  * @param configFileName name of the configuration file
@@ -57,8 +97,8 @@ static bool process_config(const char* configFileName) {
 		}
 
 		// initialize debug flag
-		char debugProp[MAXBUF];
-		if (findProperty(httpConfig, 0, "Debug", debugProp) != SIZE_MAX) {
+		const char *debugProp = findPropertyValue(httpConfig, "Debug");
+		if (debugProp != NULL) {
 			server.debug =  (strcasecmp(debugProp, "true") == 0);
 		}
 
@@ -73,8 +113,8 @@ static bool process_config(const char* configFileName) {
         }
 
 		// set server root directory
-		char rootDirProp[MAXBUF];
-		if (findProperty(httpConfig, 0, "ServerRoot", rootDirProp) != SIZE_MAX) {
+		const char *rootDirProp = findPropertyValue(httpConfig, "ServerRoot");
+		if (rootDirProp != NULL) {
 			if (chdir(rootDirProp) != 0) {
 				perror("setServerRoot");
 				status = false;
@@ -84,8 +124,8 @@ static bool process_config(const char* configFileName) {
 
 		// initialize the listener port
 		server.server_port = DEFAULT_HTTP_PORT;
-		char listenProp[MAXBUF];
-		if (findProperty(httpConfig, 0, "Port", listenProp) != SIZE_MAX) {
+		const char *listenProp = findPropertyValue(httpConfig, "Port");
+		if (listenProp != NULL) {
 			if (   (sscanf(listenProp, "%d", &server.server_port) != 1)
 				|| (server.server_port < MIN_PORT)
 				|| (server.server_port > MAX_PORT)) {
@@ -95,20 +135,33 @@ static bool process_config(const char* configFileName) {
 			}
 		}
 
+		// set path of an additional UNIX domain listener if specified
+		static char listenUnixProp[MAXBUF];
+		server.listen_unix = NULL;
+		const char *listenUnix = findPropertyValue(httpConfig, "ListenUnix");
+		if (listenUnix != NULL) {
+			if (strlen(listenUnix) >= MAX_HOST_LEN) {
+				fprintf(stderr, "Invalid UNIX listener path %s\n", listenUnix);
+				status = false;
+				break;
+			}
+			server.listen_unix = strcpy(listenUnixProp, listenUnix);
+		}
+
 		// set content base property if specified or use default "content"
 		static char contentBaseProp[MAXBUF] = "content";
 		server.content_base = contentBaseProp;
-		findProperty(httpConfig, 0, "ContentBase", contentBaseProp);
+		copyProperty(httpConfig, "ContentBase", contentBaseProp);
 
 		// set server host property or use default "localhost"
 		static char serverHostProp[MAXBUF] = "localhost";
 		server.server_host = serverHostProp;
-		findProperty(httpConfig, 0, "ServerHost", serverHostProp);
+		copyProperty(httpConfig, "ServerHost", serverHostProp);
 
 		// set default server name property if not set
 		static char serverNameProp[MAXBUF];
 		server.server_name = serverNameProp;
-		if (findProperty(httpConfig, 0, "ServerName", serverNameProp) == SIZE_MAX) {
+		if (!copyProperty(httpConfig, "ServerName", serverNameProp)) {
 			// set default server name as serverhost:port
 			sprintf(serverNameProp,"%s:%d", server.server_host, server.server_port);
 		}
@@ -116,12 +169,165 @@ static bool process_config(const char* configFileName) {
 		// set server response protocol property or use default "HTTP/1.1"
 		static char serverProtocolProp[MAXBUF] = "HTTP/1.1";
 		server.server_protocol = serverProtocolProp;
-		findProperty(httpConfig, 0, "ServerProtocol", serverProtocolProp);
+		copyProperty(httpConfig, "ServerProtocol", serverProtocolProp);
 		
-		// set content base property if specified or use default "mime.types"
-		static char contentTypesProp[MAXBUF] = "mime.types";
-		if (findProperty(httpConfig, 0, "ContentTypes", contentTypesProp) != SIZE_MAX) {
+		// select I/O backend: "epoll" (default) or "io_uring"
+		server.io_uring = false;
+		const char *ioBackendProp = findPropertyValue(httpConfig, "IoBackend");
+		if (ioBackendProp != NULL) {
+			if (strcasecmp(ioBackendProp, "io_uring") == 0) {
+				server.io_uring = true;
+			} else if (strcasecmp(ioBackendProp, "epoll") != 0) {
+				fprintf(stderr, "Invalid I/O backend %s\n", ioBackendProp);
+				status = false;
+				break;
+			}
+		}
+		if (server.io_uring && !uring_available()) {
+			fprintf(stderr, "io_uring unavailable, using epoll\n");
+			server.io_uring = false;
+		}
+
+		// set number of worker threads
+		server.threads = DEFAULT_THREADS;
+		const char *threadsProp = findPropertyValue(httpConfig, "Threads");
+		if (threadsProp != NULL) {
+			if ((sscanf(threadsProp, "%d", &server.threads) != 1) || (server.threads < 1)) {
+				fprintf(stderr, "Invalid threads %s\n", threadsProp);
+				status = false;
+				break;
+			}
+		}
+
+		// set number of shards: a count, "auto" for one per cpu, or 0 for none
+		server.shards = 0;
+		const char *shardsProp = findPropertyValue(httpConfig, "Shards");
+		if (shardsProp != NULL) {
+			if (strcasecmp(shardsProp, "auto") == 0) {
+				server.shards = shard_cpu_count();
+			} else if ((sscanf(shardsProp, "%d", &server.shards) != 1) || (server.shards < 0)) {
+				fprintf(stderr, "Invalid shards %s\n", shardsProp);
+				status = false;
+				break;
+			}
+		}
+
+		// set persistent connection limits; KeepAlive=false closes after each request
+		server.keep_alive_max = DEFAULT_KEEP_ALIVE_MAX;
+		const char *keepAliveProp = findPropertyValue(httpConfig, "KeepAlive");
+		if (keepAliveProp != NULL) {
+			if (strcasecmp(keepAliveProp, "false") == 0) {
+				server.keep_alive_max = 0;
+			}
+		}
+		if (server.keep_alive_max > 0
+			&& (keepAliveProp = findPropertyValue(httpConfig, "MaxKeepAliveRequests")) != NULL) {
+			if (sscanf(keepAliveProp, "%u", &server.keep_alive_max) != 1) {
+				fprintf(stderr, "Invalid max keep-alive requests %s\n", keepAliveProp);
+				status = false;
+				break;
+			}
+		}
+		server.keep_alive_timeout = DEFAULT_KEEP_ALIVE_TIMEOUT;
+		if ((keepAliveProp = findPropertyValue(httpConfig, "KeepAliveTimeout")) != NULL) {
+			if ((sscanf(keepAliveProp, "%d", &server.keep_alive_timeout) != 1)
+				|| (server.keep_alive_timeout < 1)) {
+				fprintf(stderr, "Invalid keep-alive timeout %s\n", keepAliveProp);
+				status = false;
+				break;
+			}
+		}
+
+		// set request timeouts in seconds
+		struct {
+			const char *name;
+			int *value;
+		} timeoutProps[] = {
+			{ "RequestHeaderTimeout", &server.header_timeout },
+			{ "RequestBodyTimeout", &server.body_timeout },
+			{ "RequestTimeout", &server.request_timeout }
+		};
+		server.header_timeout = DEFAULT_HEADER_TIMEOUT;
+		server.body_timeout = DEFAULT_BODY_TIMEOUT;
+		server.request_timeout = DEFAULT_REQUEST_TIMEOUT;
+		for (size_t i = 0; status && i < sizeof(timeoutProps)/sizeof(timeoutProps[0]); i++) {
+			const char *timeoutProp = findPropertyValue(httpConfig, timeoutProps[i].name);
+			if (timeoutProp != NULL) {
+				if ((sscanf(timeoutProp, "%d", timeoutProps[i].value) != 1)
+					|| (*timeoutProps[i].value < 1)) {
+					fprintf(stderr, "Invalid %s %s\n", timeoutProps[i].name, timeoutProp);
+					status = false;
+				}
+			}
+		}
+		if (!status) {
+			break;
+		}
+
+		// set seconds to drain connections when stopping or restarting
+		server.drain_timeout = DEFAULT_DRAIN_TIMEOUT;
+		const char *drainProp = findPropertyValue(httpConfig, "DrainTimeout");
+		if (drainProp != NULL) {
+			if ((sscanf(drainProp, "%d", &server.drain_timeout) != 1)
+				|| (server.drain_timeout < 0)) {
+				fprintf(stderr, "Invalid drain timeout %s\n", drainProp);
+				status = false;
+				break;
+			}
+		}
+
+		// set admission control; AdmissionLatency=0 admits every request
+		server.admission_latency = DEFAULT_ADMISSION_LATENCY;
+		const char *admissionProp = findPropertyValue(httpConfig, "AdmissionLatency");
+		if (admissionProp != NULL) {
+			if ((sscanf(admissionProp, "%d", &server.admission_latency) != 1)
+				|| (server.admission_latency < 0)) {
+				fprintf(stderr, "Invalid admission latency %s\n", admissionProp);
+				status = false;
+				break;
+			}
+		}
+		server.retry_after = DEFAULT_RETRY_AFTER;
+		if ((admissionProp = findPropertyValue(httpConfig, "RetryAfter")) != NULL) {
+			if ((sscanf(admissionProp, "%d", &server.retry_after) != 1)
+				|| (server.retry_after < 0)) {
+				fprintf(stderr, "Invalid retry after %s\n", admissionProp);
+				status = false;
+				break;
+			}
+		}
+
+		// set listener tuning options; 0 leaves the system default
+		struct {
+			const char *name;
+			int *value;
+		} listenerProps[] = {
+			{ "ListenBacklog", &server.listener.backlog },
+			{ "TcpDeferAccept", &server.listener.defer_accept },
+			{ "TcpFastOpen", &server.listener.fastopen },
+			{ "SocketReceiveBuffer", &server.listener.rcvbuf },
+			{ "SocketSendBuffer", &server.listener.sndbuf }
+		};
+		server.listener.backlog = DEFAULT_LISTEN_BACKLOG;
+		for (size_t i = 0; status && i < sizeof(listenerProps)/sizeof(listenerProps[0]); i++) {
+			const char *listenerProp = findPropertyValue(httpConfig, listenerProps[i].name);
+			if (listenerProp != NULL) {
+				if ((sscanf(listenerProp, "%d", listenerProps[i].value) != 1)
+					|| (*listenerProps[i].value < 0)) {
+					fprintf(stderr, "Invalid %s %s\n", listenerProps[i].name, listenerProp);
+					status = false;
+				}
+			}
+		}
+		if (!status) {
+			break;
+		}
+
+		// read media types if specified in place of the built-in table
+		const char *contentTypesProp = findPropertyValue(httpConfig, "ContentTypes");
+		if (contentTypesProp != NULL) {
 			if (readMediaTypes(contentTypesProp) == 0) {
+				fprintf(stderr, "Invalid ContentTypes %s\n", contentTypesProp);
 				status = false;
 				break;
 			}
@@ -134,9 +340,88 @@ static bool process_config(const char* configFileName) {
 }
 
 /**
- * Main program starts the server and processes requests
+ * Get the listener sockets of the server: those handed off by
+ * the server that started this one, or new ones. The TCP listeners
+ * are followed by the UNIX domain listener if one is configured.
+ *
+ * @param listen_fds the array for the listener sockets
+ * @param ntcp the number of TCP listener sockets
+ * @return the number of listener sockets, or 0 if error
+ */
+static int get_listeners(int *listen_fds, int ntcp) {
+	int nlisteners = ntcp + (server.listen_unix != NULL);
+	int inherited[RESTART_MAX_LISTENERS];
+	int ninherited = restart_inherit_listeners(inherited, RESTART_MAX_LISTENERS);
+	if (ninherited < 0) {
+		perror("restart_inherit_listeners");
+		return 0;
+	}
+
+	// sort inherited listeners by family; any the server no longer uses are closed
+	int ntaken = 0;
+	bool have_unix = false;
+	for (int i = 0; i < ninherited; i++) {
+		if (get_socket_family(inherited[i]) == AF_UNIX) {
+			if (server.listen_unix != NULL && !have_unix) {
+				listen_fds[ntcp] = inherited[i];
+				have_unix = true;
+				continue;
+			}
+		} else if (ntaken < ntcp) {
+			listen_fds[ntaken++] = inherited[i];
+			continue;
+		}
+		close(inherited[i]);
+	}
+	if (ninherited > 0) {
+		reserve_shed_descriptor();
+		if (server.debug) {
+			fprintf(stderr, "Inherited %d listeners\n", ntaken + have_unix);
+		}
+	}
+
+	// shards share the port with SO_REUSEPORT
+	for (int i = ntaken; i < ntcp; i++) {
+		listen_fds[i] = get_listener_socket(server.server_port, server.shards > 0, &server.listener);
+		if (listen_fds[i] == 0) {
+			perror("listen_sock_fd");
+			return 0;
+		}
+	}
+	if (server.listen_unix != NULL && !have_unix) {
+		listen_fds[ntcp] = get_unix_listener_socket(server.listen_unix, &server.listener);
+		if (listen_fds[ntcp] == 0) {
+			perror("listen_unix");
+			return 0;
+		}
+	}
+	return nlisteners;
+}
+
+/**
+ * Make a relative path absolute against the starting directory,
+ * since the server changes to its root directory. Symbolic links
+ * are kept, so that a restart runs the binary a link names now.
+ * @param path the path
+ * @param cwd the starting directory
+ * @param absPath storage for the absolute path, of MAXPATHLEN bytes
+ * @return the absolute path, or path if it is absolute or too long
+ */
+static const char *absolutePath(const char *path, const char *cwd, char *absPath) {
+	if (path[0] == '/' || cwd[0] == '\0'
+			|| snprintf(absPath, MAXPATHLEN, "%s/%s", cwd, path) >= MAXPATHLEN) {
+		return path;
+	}
+	return absPath;
+}
+
+/**
+ * Main program starts the server and processes requests.
+ * SIGUSR2 starts a new server binary that takes over the
+ * listeners, and SIGTERM stops the server; either way the
+ * server drains its open connections before it exits.
  * @param argc argument count
- * @param argv array of args; argv[1] may be port no.
+ * @param argv array of args; argv[1] may be config file name
  */
 int main(int argc, char* argv[argc]) {
 
@@ -146,47 +431,101 @@ int main(int argc, char* argv[argc]) {
     	configFileName = argv[1];
     }
 
+	// a new server is started with paths that do not depend on the
+	// directory this one changes to; a binary without '/' is found on PATH
+	char cwd[MAXPATHLEN];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		cwd[0] = '\0';
+	}
+	char binPath[MAXPATHLEN];
+	char configPath[MAXPATHLEN];
+	char *restartArgv[] = {
+		argv[0], (char *)absolutePath(configFileName, cwd, configPath), NULL
+	};
+	if (strchr(argv[0], '/') != NULL) {
+		restartArgv[0] = (char *)absolutePath(argv[0], cwd, binPath);
+	}
+
 	// load property file with server configuration
 	if (!process_config(configFileName)) {
 		return EXIT_FAILURE;
 	}
 
-    // create listener socket for server with specified port
-    int listen_sock_fd = get_listener_socket(server.server_port);
-	if (listen_sock_fd == 0) {
-		perror("listen_sock_fd");
+	// signals are handled by the main thread; threads it starts inherit the mask
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR2);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	// sendfile() cannot suppress SIGPIPE as send() does with MSG_NOSIGNAL
+	signal(SIGPIPE, SIG_IGN);
+
+	// without shards, the server runs as a single unpinned shard
+	int nshards = (server.shards > 0) ? server.shards : 1;
+	if (nshards + (server.listen_unix != NULL) > RESTART_MAX_LISTENERS) {
+		fprintf(stderr, "Too many shards %d\n", nshards);
 		return EXIT_FAILURE;
 	}
+	int listen_fds[nshards + 1];
+	int nlisteners = get_listeners(listen_fds, nshards);
+	if (nlisteners == 0) {
+		return EXIT_FAILURE;
+	}
+	int unix_fd = (nlisteners > nshards) ? listen_fds[nshards] : -1;
 
-	if (server.debug) {
+	// each shard has its own listener, event loop and worker threads,
+	// and all shards accept from the UNIX domain listener
+	struct shard *shards = start_shards(nshards, listen_fds, unix_fd, server.threads, server.shards > 0);
+	if (shards == NULL) {
+		perror("start_shards");
+		return EXIT_FAILURE;
+	}
+	if (server.debug && server.shards > 0) {
+		fprintf(stderr, "HttpServer running on port %d with %d shards\n",
+				server.server_port, server.shards);
+	} else if (server.debug) {
 		fprintf(stderr, "HttpServer running on port %d\n", server.server_port);
 	}
+	if (server.debug) {
+		fprintf(stderr, "String kernels: %s\n", str_kernels_isa());
+	}
+	if (server.debug && unix_fd >= 0) {
+		fprintf(stderr, "HttpServer listening on %s\n", server.listen_unix);
+	}
 
-    threadpool thpool = thpool_init(16);
-
-	while (true) {
-        // accept client connection
-		int socket_fd = accept_peer_connection(listen_sock_fd);
+	// server that started this one can stop accepting
+	restart_ready();
 
-		if (server.debug) {
-			int port;
-			char host[MAXBUF];
-			if (get_peer_host_and_port(socket_fd, host, &port) != 0) {
-			    perror("get_peer_host_and_port");
-			} else if (server.debug) {
-				fprintf(stderr, "New connection accepted  %s:%u\n", host, port);
+	int sig;
+	bool handed_off = false;
+	while (sigwait(&signals, &sig) == 0) {
+		if (sig != SIGUSR2) {
+			break;
+		}
+		if (restart_exec(restartArgv, listen_fds, nlisteners) == 0) {
+			if (server.debug) {
+				fprintf(stderr, "New server started, draining\n");
 			}
+			handed_off = true;
+			break;
 		}
+		perror("restart_exec");
+	}
 
-		// handle request
-//		process_request(socket_fd);
-        thpool_add_work(thpool, param_adapter, (void*)(uintptr_t)socket_fd);
-    }
-
-    thpool_destroy(thpool);
+	// socket path is removed unless a new server accepts on it
+	if (unix_fd >= 0 && !handed_off) {
+		unlink(server.listen_unix);
+	}
 
-    // close listener socket
-    close(listen_sock_fd);
+	// stop accepting, and exit once connections are closed
+	__atomic_store_n(&server.draining, true, __ATOMIC_RELAXED);
+	drain_shards(shards, nshards);
+	join_shards(shards, nshards);
+	if (unix_fd >= 0) {
+		close(unix_fd);
+	}
+	free(shards);
     return EXIT_SUCCESS;
 
 }
@@ -12,6 +12,7 @@
 
 #include <stdbool.h>
 #include "properties.h"
+#include "network_util.h"
 
 /** maximum buffer size */
 #define MAXBUF 256
@@ -36,8 +37,50 @@ struct http_server_conf {
 	/** port number of http server */
 	int server_port;
 
+	/** path of the UNIX domain listener socket, or NULL if none */
+	const char *listen_unix;
+
 	/** http response protocol */
 	const char* server_protocol;
+
+	/** use io_uring rather than epoll to accept and receive, and to stat and open files */
+	bool io_uring;
+
+	/** number of worker threads */
+	int threads;
+
+	/** number of per-core shards, or 0 for a single listener */
+	int shards;
+
+	/** maximum requests per connection, or 0 to close after each */
+	unsigned keep_alive_max;
+
+	/** seconds a connection may wait for a request */
+	int keep_alive_timeout;
+
+	/** seconds a request line and headers may take to arrive */
+	int header_timeout;
+
+	/** seconds a request handler may wait for the socket */
+	int body_timeout;
+
+	/** seconds a request may take from its first byte to its response */
+	int request_timeout;
+
+	/** target average request latency in milliseconds, or 0 to admit all */
+	int admission_latency;
+
+	/** seconds a client is asked to wait when a request is refused */
+	int retry_after;
+
+	/** seconds to wait for open connections to close when stopping */
+	int drain_timeout;
+
+	/** set when the server stops accepting connections */
+	bool draining;
+
+	/** listener socket tuning options */
+	struct listener_options listener;
 };
 
 /**  external declaration of server config */
@@ -7,116 +7,139 @@
  *  @author: Philip Gust
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
+#include <sys/uio.h>
+#include "connection.h"
+#include "http_parser.h"
 #include "properties.h"
 #include "file_util.h"
 #include "string_util.h"
+#include "simd_util.h"
 #include "http_server.h"
 
+/** buffer size for directory listing html; MAXBSIZE is not defined on Linux */
+#ifndef MAXBSIZE
+#define MAXBSIZE 65536
+#endif
+
+
+/** a status line after the protocol, precomputed for statuses the server sends */
+#define STATUS_LINE(status, statusMsg) \
+	{ status, " " #status " " statusMsg CRLF, sizeof(" " #status " " statusMsg CRLF) - 1 }
+
+static const struct {
+	int status;
+	const char *line;
+	size_t len;
+} statusLines[] = {
+	STATUS_LINE(200, "OK"),
+	STATUS_LINE(201, "Created"),
+	STATUS_LINE(400, "Bad Request"),
+	STATUS_LINE(404, "Not Found"),
+	STATUS_LINE(405, "Method Not Allowed"),
+	STATUS_LINE(411, "Length Required"),
+	STATUS_LINE(414, "URI Too Long"),
+	STATUS_LINE(431, "Request Header Fields Too Large"),
+	STATUS_LINE(500, "Internal Server Error"),
+	STATUS_LINE(501, "Not Implemented"),
+	STATUS_LINE(503, "Service Unavailable")
+};
 
 /**
- * Reads request headers from request stream until empty line.
+ * Send the status line and headers of a response, followed by
+ * any body bytes. The status line and headers are formatted into
+ * one buffer, and are sent together with the body by a single
+ * vectored write if they do not fit in the response buffer.
  *
- * @param istream the socket input stream
- * @param request headers
+ * @param conn the client connection
+ * @param status the response status
+ * @param statusMsg the response message
+ * @param responseHeaders the header name value pairs
+ * @param body the body bytes, or NULL if none
+ * @param bodyLen the number of body bytes
  */
-void readRequestHeaders(FILE *istream, Properties *requestHeaders) {
-	char buf[MAXBUF];
-
-	while (fgets(buf, MAXBUF, istream) != NULL) {
-		// trim newline characters
-		trim_newline(buf);
-
-		// empty line marks send of headers
-		if (*buf == '\0') {
+void sendResponse(struct connection *conn, int status, const char *statusMsg,
+				  Properties *responseHeaders, const char *body, size_t bodyLen) {
+	// status line after the protocol, formatted if not precomputed
+	const char *line = NULL;
+	size_t lineLen = 0;
+	for (size_t i = 0; i < sizeof(statusLines) / sizeof(statusLines[0]); i++) {
+		if (statusLines[i].status == status) {
+			line = statusLines[i].line;
+			lineLen = statusLines[i].len;
 			break;
 		}
-
-		char *p = strchr(buf, ':'); // find name/value delimiter
-		if (p != NULL) {
-			for (*p++ = '\0'; *p == ' '; p++) {} // skip over leading value whitespace
-			if (!putProperty(requestHeaders, buf, p)) {  // save request property
-				fprintf(stderr, "readRequestHeaders requestHeaders full\n");
-				break;
-			}
-		}
 	}
-}
-
-/**
- * Send bytes for status to response output stream.
- *
- * @param ostream the output socket stream
- * @param status the response status
- * @param statusMsg the response message
- */
-void sendResponseStatus(FILE *ostream, int status, const char *statusMsg) {
-	fprintf(ostream, "%s %d %s %s", server.server_protocol, status, statusMsg, CRLF);
-	if (server.debug) {
-		fprintf(stderr, "%s %d %s\n", server.server_protocol, status, statusMsg);
+	char lineBuf[MAXBUF];
+	if (line == NULL) {
+		lineLen = snprintf(lineBuf, sizeof(lineBuf), " %d %s%s", status, statusMsg, CRLF);
+		line = lineBuf;
 	}
-}
-
 
-/**
- * Send bytes for headers to response output stream
- * with terminating blank line.
- *
- * @param responseHeaders the header name value pairs
- * @param responseCharset the response charset
- */
-void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
-	// output headers
-	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
-	for (int i = 0; getProperty(responseHeaders, i, name, val); i++) {
-		fprintf(ostream, "%s: %s%s", name, val, CRLF);
-    	if (server.debug) {
-    		fprintf(stderr, "%s: %s\n", name, val);
-    	}
+	// size the response head, then format it
+	size_t protocolLen = strlen(server.server_protocol);
+	size_t headLen = protocolLen + lineLen + 2;
+	PropertyIterator iter;
+	PropertyView header;
+	startProperties(responseHeaders, &iter);
+	while (nextProperty(&iter, &header)) {
+		headLen += header.nameLen + header.valLen + 4;
 	}
-
-	// Send a blank line to indicate the end of the header lines.
-	fprintf(ostream, "%s", CRLF);
+	char *head = arena_alloc(&conn->arena, headLen);
+	if (head == NULL) {
+		conn->error = true;
+		return;
+	}
+	char *p = mempcpy(head, server.server_protocol, protocolLen);
+	p = mempcpy(p, line, lineLen);
+	startProperties(responseHeaders, &iter);
+	while (nextProperty(&iter, &header)) {
+		p = mempcpy(p, header.name, header.nameLen);
+		p = mempcpy(p, ": ", 2);
+		p = mempcpy(p, header.val, header.valLen);
+		p = mempcpy(p, CRLF, 2);
+	}
+	// blank line to indicate the end of the header lines
+	memcpy(p, CRLF, 2);
+
+	struct iovec iov[2] = {
+		{ .iov_base = head, .iov_len = headLen },
+		{ .iov_base = (void *)body, .iov_len = bodyLen }
+	};
+	conn_writev(conn, iov, (bodyLen > 0) ? 2 : 1);
 	if (server.debug) {
-		fprintf(stderr, "\n");
+		fwrite(head, 1, headLen, stderr);
 	}
 }
 
 /**
- * Set error response and error page to the response output stream.
+ * Set error response and error page to the client connection.
  *
- * @param ostream the output socket stream
+ * @param conn the client connection
  * @param status the response status
  * @param statusMsg the response message
  * @param responseHeaders the response headers
  */
-void sendErrorResponse(FILE* ostream, int status, const char *statusMsg, Properties *responseHeaders) {
-	sendResponseStatus(ostream, status, statusMsg);
-
+void sendErrorResponse(struct connection *conn, int status, const char *statusMsg, Properties *responseHeaders) {
 	char errorBody[2*MAXBUF];  // because of data substitution.
 	const char *errorPage =
 		"<html>"
 	    "<head><title>%d %s</title></head>"
 	    "<body>%d %s</body></html>";
-	sprintf(errorBody, errorPage, status, statusMsg, status, statusMsg);
-	FILE *tmpStream = tmpStringFile(errorBody);
+	size_t contentLen = sprintf(errorBody, errorPage, status, statusMsg, status, statusMsg);
 
 	char buf[MAXBUF];
-	size_t contentLen = strlen(errorBody);
-	sprintf(buf, "%lu", contentLen);
+	utostr(buf, contentLen);
 	putProperty(responseHeaders,"Content-Length", buf);
 	putProperty(responseHeaders,"Content-type", "text/html");
 
-
-	// Send the headers
-	sendResponseHeaders(ostream, responseHeaders);
-
-	// Send the error page body.
-	copyFileStreamBytes(tmpStream, ostream, contentLen);
-	fclose(tmpStream);
+	// Send the headers and error page body; no temporary file is
+	// needed, so errors can be reported when out of descriptors
+	sendResponse(conn, status, statusMsg, responseHeaders, errorBody, contentLen);
 }
 
 /**
@@ -124,23 +147,14 @@ void sendErrorResponse(FILE* ostream, int status, const char *statusMsg, Propert
  * the corresponding character code.
  * @param escUrl the esc URI
  * @param uri the decoded URI
- * @return the URL if successful, NULL if error
+ * @return the URL if successful, NULL if an escape is malformed or %00
  */
 char *unescapeUri(const char *escUri, char *uri) {
-	char *p = uri;
-	while (*escUri) {
-		if ( *escUri == '%') {
-			int c;
-			if (sscanf(escUri, "%%%02x", &c) == 0) {
-				return NULL;
-			}
-			*p++ = (unsigned char)c;
-			escUri+=3;
-		} else {
-			*p++ = *escUri++;
-		}
+	ssize_t len = str_percent_decode(uri, escUri, strlen(escUri));
+	if (len < 0) {
+		return NULL;
 	}
-	*p++ = '\0';
+	uri[len] = '\0';
 	return uri;
 }
 
@@ -159,14 +173,22 @@ char *resolveUri(const char *uri, char *fspath) {
 /**
  * Debug request by printing request and request headers
  *
- * @param request the request line
- * @param requestHeaders the request headers
+ * @param requestLine the request line
+ * @param request the request with its recognized headers
+ * @param requestHeaders the other request headers
  */
-void debugRequest(const char *request, Properties *requestHeaders) {
-	char name[MAXBUF], val[MAXBUF];
-	fprintf(stderr, "\n%s\n", request);
-	for (int i = 0; getProperty(requestHeaders, i, name, val); i++) {
-		fprintf(stderr, "%s: %s\n", name, val);
+void debugRequest(const char *requestLine, const struct http_request *request, Properties *requestHeaders) {
+	fprintf(stderr, "\n%s\n", requestLine);
+	for (int id = 0; id < HTTP_HEADER_COUNT; id++) {
+		if (request->headers[id] != NULL) {
+			fprintf(stderr, "%s: %s\n", http_header_name(id), request->headers[id]);
+		}
+	}
+	PropertyIterator iter;
+	PropertyView header;
+	startProperties(requestHeaders, &iter);
+	while (nextProperty(&iter, &header)) {
+		fprintf(stderr, "%s: %s\n", header.name, header.val);
 	}
 	fprintf(stderr, "\n");
 }
@@ -177,14 +199,16 @@ void debugRequest(const char *request, Properties *requestHeaders) {
  */
 void startHtmlPage(const char *uri, FILE* fname) {
     char htmlData[MAXBSIZE];
+    char escUri[6 * MAXPATHLEN + 1];
+    str_html_escape(escUri, uri, strnlen(uri, MAXPATHLEN));
 
     strcpy(htmlData, "<html>\n<head>\n"
                       "  <title>index of ");
-    strcat(htmlData, uri);
+    strcat(htmlData, escUri);
     strcat(htmlData, "</title></head>\n"
                        "<body>\n"
                        "  <h1>Index of ");
-    strcat(htmlData, uri);
+    strcat(htmlData, escUri);
     strcat(htmlData, "</h1>\n"
                        "  <table>\n"
                        "  <tr>\n"
@@ -245,8 +269,8 @@ void makeHtmlEntry(FILE* fname, const char *name, const char *mtime, off_t size,
         strcpy(fileName, "Parent Directory");
         strcpy(fileLink, "../");
     } else {
-        strcpy(fileName, name);
-        strcpy(fileLink, name);
+        str_html_escape(fileName, name, strnlen(name, MAXPATHLEN));
+        strcpy(fileLink, fileName);
 
         if (S_ISDIR(mode)) {
             strcat(fileLink, "/");
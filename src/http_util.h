@@ -10,45 +10,37 @@
 #ifndef HTTP_UTIL_H_
 #define HTTP_UTIL_H_
 
+#include <stdio.h>
+#include "http_parser.h"
 #include "properties.h"
 
-/**
- * Reads request headers from request stream until empty line.
- *
- * @param istream the socket input stream
- * @param request headers
- * @throws IOException if error occurs
- */
-void readRequestHeaders(FILE *istream, Properties *requestHeader);
+struct connection;
 
 /**
- * Send bytes for status to response output stream.
+ * Send the status line and headers of a response, followed by
+ * any body bytes. The status line and headers are formatted into
+ * one buffer, and are sent together with the body by a single
+ * vectored write if they do not fit in the response buffer.
  *
+ * @param conn the client connection
  * @param status the response status
  * @param statusMsg the response message
- * @param responseCharset the response charset
- * @throws IOException if error occurs
- */
-void sendResponseStatus(FILE *ostream, int status, const char *statusMsg);
-
-/**
- * Send bytes for headers to response output stream.
- *
  * @param responseHeaders the header name value pairs
- * @param responseCharset the response charset
- * @throws IOException if errors occur
+ * @param body the body bytes, or NULL if none
+ * @param bodyLen the number of body bytes
  */
-void sendResponseHeaders(FILE *ostream, Properties *responseHeaders);
+void sendResponse(struct connection *conn, int status, const char *statusMsg,
+				  Properties *responseHeaders, const char *body, size_t bodyLen);
 
 /**
- * Set error response and error page to the response output stream.
+ * Set error response and error page to the client connection.
  *
- * @param ostream the output socket stream
+ * @param conn the client connection
  * @param status the response status
  * @param statusMsg the response message
  * @param responseHeaders the response headers
  */
-void sendErrorResponse(FILE* ostream, int status, const char *statusMsg, Properties *responseHeaders);
+void sendErrorResponse(struct connection *conn, int status, const char *statusMsg, Properties *responseHeaders);
 
 /**
  * Unescape a URI string by replacing %xx with
@@ -70,10 +62,11 @@ char *resolveUri(const char *uri, char *fspath);
 /**
  * Debug request by printing request and request headers
  *
- * @param request the request line
- * @param requestHeaders the request headers
+ * @param requestLine the request line
+ * @param request the request with its recognized headers
+ * @param requestHeaders the other request headers
  */
-void debugRequest(const char *request, Properties *requestHeaders);
+void debugRequest(const char *requestLine, const struct http_request *request, Properties *requestHeaders);
 
 /**
  * Write initial HTML code in file
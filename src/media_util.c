@@ -9,98 +9,169 @@
 
 #include "media_util.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <ctype.h>
-#include "string_util.h"
-#include "http_server.h"
+#include <sys/stat.h>
+#include "simd_util.h"
 #include "file_util.h"
 
+/** built-in table generated from "mime.types" at build time */
+#include "media_types.h"
+
 /** default media type */
 static const char *DEFAULT_MEDIA_TYPE = "application/octet-stream";
 
-/** global Properties instance */
-static Properties *props;
+/** media types read at runtime in place of the built-in table, or NULL if none */
+static struct media_type *runtimeTypes;
+
+/** number of slots in runtimeTypes; a power of 2 */
+static size_t runtimeSlots;
+
+/** contents of the file read at runtime, which runtimeTypes points into */
+static char *runtimeFile;
+
+/**
+ * Determine whether a table entry is for an extension, ignoring case.
+ *
+ * @param entry the table entry
+ * @param ext the extension
+ * @param len the length of the extension
+ * @return true if the entry is for the extension
+ */
+static bool isMediaType(const struct media_type *entry, const char *ext, size_t len) {
+	return (entry->len == len) && str_caseeq(entry->ext, ext, len);
+}
 
 /**
- * Read the file extensions and media types into global Properties instance
+ * Read file extensions and media types to use in place of
+ * the built-in table generated from "mime.types" at build time.
+ * The first media type of an extension is used.
  *
  * @param filename the name of the "mime.types" file
- * @return the number of entries in Properties
+ * @return the number of extensions read
  */
 int readMediaTypes(const char *filename) {
-
-    FILE *typeStream = fopen(filename, "r");
+	FILE *typeStream = fopen(filename, "r");
 	if (typeStream == NULL) {
 		return 0;
 	}
 
-	// If there is no Properties instance, this method creates one.
-	// If there is a Properties instance, this method replaces it with one created from this file.
-	if (props != NULL) {
-		deleteProperties(props);
+	// read the whole file; table entries point into it
+	struct stat sb;
+	char *file = NULL;
+	size_t nread = 0;
+	if (fileStat(typeStream, &sb) == 0 && (file = malloc(sb.st_size + 1)) != NULL) {
+		nread = fread(file, sizeof(char), sb.st_size, typeStream);
+		file[nread] = '\0';
+	}
+	fclose(typeStream);
+	if (file == NULL) {
+		return 0;
+	}
+
+	// split each line into a media type and its extensions
+	struct media_type *entries = NULL;
+	size_t nentries = 0, maxentries = 0;
+	char *saveLine;
+	for (char *line = strtok_r(file, "\n", &saveLine); line != NULL; line = strtok_r(NULL, "\n", &saveLine)) {
+		char *saveToken;
+		char *type = strtok_r(line, " \t\r", &saveToken);
+		if (type == NULL || type[0] == '#') { // ignore comment
+			continue;
+		}
+		for (char *ext; (ext = strtok_r(NULL, " \t\r", &saveToken)) != NULL; ) {
+			if (nentries == maxentries) {
+				maxentries = (maxentries == 0) ? 64 : 2*maxentries;
+				entries = realloc(entries, maxentries*sizeof(struct media_type));
+				if (entries == NULL) {
+					perror("readMediaTypes");
+					exit(1);
+				}
+			}
+			entries[nentries].ext = ext;
+			entries[nentries].len = strlen(ext);
+			entries[nentries].type = type;
+			nentries++;
+		}
+	}
+	if (nentries == 0) {
+		free(entries);
+		free(file);
+		return 0;
+	}
+
+	// index extensions in a table at most half full
+	size_t nslots = 1;
+	while (nslots < 2*nentries) {
+		nslots *= 2;
+	}
+	struct media_type *types = calloc(nslots, sizeof(struct media_type));
+	if (types == NULL) {
+		perror("readMediaTypes");
+		exit(1);
 	}
-	props = newProperties();
-
-	// create a reader to read file line by line
-    char *line = NULL;
-    size_t len = 0;
-    int nprops = 0;
-
-    while (getline(&line, &len, typeStream) != -1) {
-    	char *type = strtok(line, " "); // split line by spaces
-    	if (strcmp(type, "#") == 0) { // ignore comment
-    		continue;
-    	}
-
-    	char *token = type;
- 	    while (token != NULL) {
- 	    	token = strtok(NULL, " ");
- 	    	if (token != NULL) {
- 	    		// put extension (key) and type (value) into property
- 	    		putProperty(props, token, type);
- 	    		nprops++;
- 	    	}
- 	    }
-    }
-    fclose(typeStream);
-    return nprops;
+	for (size_t i = 0; i < nentries; i++) {
+		size_t slot = media_hash(entries[i].ext, entries[i].len) & (nslots - 1);
+		while (types[slot].len != 0 && !isMediaType(&types[slot], entries[i].ext, entries[i].len)) {
+			slot = (slot + 1) & (nslots - 1);  // linear probing
+		}
+		if (types[slot].len == 0) {
+			types[slot] = entries[i];
+		}
+	}
+	free(entries);
+
+	// replace the built-in table or the table previously read
+	free(runtimeTypes);
+	free(runtimeFile);
+	runtimeTypes = types;
+	runtimeSlots = nslots;
+	runtimeFile = file;
+	return nentries;
 }
 
 /**
  * Return a media type for a given filename.
  *
  * @param filename the name of the file
- * @param mediaType output buffer for mime type
- * @return pointer to media type string
+ * @return the media type
  */
-char *getMediaType(const char *filename, char *mediaType)
-{
+const char *getMediaType(const char *filename) {
 	// special-case directory based on trailing '/'
-	if (filename[strlen(filename)-1] == '/') {
-		strcpy(mediaType, "text/directory");
-		return mediaType;
+	size_t len = strlen(filename);
+	if (len > 0 && filename[len-1] == '/') {
+		return "text/directory";
 	}
 
 	// get file extension
-    char ext[MAXBUF];
-    if (getExtension(filename, ext) == NULL) {
-    	// default if no extension
-    	strcpy(mediaType, DEFAULT_MEDIA_TYPE);
-    	return mediaType;
-    }
-
-    // lower-case extension
-    strlower(ext, ext);
-
-    // use global Properties instance to get the media type
-    // if the file extension is not registered, return the default media type
-//    /*const */char *mtstr = DEFAULT_MEDIA_TYPE;
-
-    if (findProperty(props, 0, ext, mediaType) == SIZE_MAX) {
-    	strcpy(mediaType, DEFAULT_MEDIA_TYPE);
-    }
+	const char *ext = strrchr(filename, '.');
+	if (ext == NULL || ext[1] == '\0') {
+		// default if no extension
+		return DEFAULT_MEDIA_TYPE;
+	}
+	ext++;
+	len = filename + len - ext;
+
+	// look up the extension ignoring case
+	uint32_t hash = media_hash(ext, len);
+	if (runtimeTypes != NULL) {
+		size_t slot = hash & (runtimeSlots - 1);
+		for (; runtimeTypes[slot].len != 0; slot = (slot + 1) & (runtimeSlots - 1)) {
+			if (isMediaType(&runtimeTypes[slot], ext, len)) {
+				return runtimeTypes[slot].type;
+			}
+		}
+	} else {
+		// one probe of the perfect hash table
+		const struct media_type *entry = &mediaTypes[
+				media_slot(hash, mediaTypeDisp[hash & (MEDIA_TYPE_BUCKETS - 1)], MEDIA_TYPE_SLOTS)];
+		if (isMediaType(entry, ext, len)) {
+			return entry->type;
+		}
+	}
 
-    return mediaType;
+	// if the file extension is not registered, return the default media type
+	return DEFAULT_MEDIA_TYPE;
 }
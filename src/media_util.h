@@ -10,11 +10,61 @@
 #ifndef MEDIA_UTIL_H_
 #define MEDIA_UTIL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+/** an entry of a media type table */
+struct media_type {
+	/** file extension, or NULL for an empty slot */
+	const char *ext;
+
+	/** length of the extension, or 0 for an empty slot */
+	size_t len;
+
+	/** media type of the extension */
+	const char *type;
+};
+
+/**
+ * Hash a file extension ignoring ASCII case, using FNV-1a.
+ * Shared with the generator of the built-in media type table.
+ *
+ * @param ext the extension
+ * @param len the length of the extension
+ * @return the hash of the extension
+ */
+static inline uint32_t media_hash(const char *ext, size_t len) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = ext[i];
+		hash = (hash ^ (((unsigned)(c - 'A') < 26u) ? c + ('a' - 'A') : c)) * 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Get the slot of a hash in a perfect hash table, given the
+ * displacement of the hash bucket chosen by the generator.
+ *
+ * @param hash the extension hash
+ * @param disp the displacement of the bucket of the hash
+ * @param nslots the number of slots; a power of 2
+ * @return the slot
+ */
+static inline size_t media_slot(uint32_t hash, uint32_t disp, size_t nslots) {
+	uint32_t h = hash + disp * 0x9e3779b9u;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h & (nslots - 1);
+}
+
 /**
- * Read the file extensions and media types into global Properties instance
+ * Read file extensions and media types to use in place of
+ * the built-in table generated from "mime.types" at build time.
  *
  * @param filename the name of the "mime.types" file
- * @return the number of entries in Properties
+ * @return the number of extensions read
  */
 int readMediaTypes(const char *filename);
 
@@ -22,9 +72,8 @@ int readMediaTypes(const char *filename);
  * Return a media type for a given filename.
  *
  * @param filename the name of the file
- * @param mediaType output buffer for media type
- * @return pointer to media type string
+ * @return the media type
  */
-char *getMediaType(const char *filename, char *mediaType);
+const char *getMediaType(const char *filename);
 
 #endif /* MEDIA_UTIL_H_ */
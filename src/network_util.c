@@ -6,13 +6,26 @@
  *  @since 2019-04-10
  *  @author: Philip Gust
  */
-
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "network_util.h"
+
+/** descriptor kept in reserve for shedding connections when out of descriptors */
+static int reserve_fd = -1;
 
 /**
  * Connect to peer at host and port.
@@ -51,16 +64,35 @@ int get_peer_socket(const char *host, int port) {
 
 }
 
+/**
+ * Set an integer socket option if its value is not 0.
+ *
+ * @param sock_fd the socket
+ * @param level the option level
+ * @param name the option name
+ * @param value the option value
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int set_sockopt_if(int sock_fd, int level, int name, int value) {
+	if (value == 0) {
+		return 0;
+	}
+	return setsockopt(sock_fd, level, name, &value, sizeof(value));
+}
+
 /**
  * Get listener socket
  *
  * @param port the port number
+ * @param reuse_port true to allow several listeners on the port,
+ *   among which the kernel distributes incoming connections
+ * @param opts the listener tuning options
  * @return listener socket or 0 if unavailable
  */
-int get_listener_socket(int port) {
+int get_listener_socket(int port, bool reuse_port, const struct listener_options *opts) {
     // Creating internet socket stream file descriptor
-    int listen_sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_sock_fd == 0) {
+    int listen_sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_sock_fd < 0) {
         return 0;
     }
 
@@ -72,6 +104,22 @@ int get_listener_socket(int port) {
     	return 0;
     }
 
+    // SO_REUSEPORT option lets each shard bind its own listener
+    if (reuse_port
+    	&& (setsockopt(listen_sock_fd, SOL_SOCKET, SO_REUSEPORT, &optval , sizeof(int)) < 0)) {
+    	close(listen_sock_fd);
+    	return 0;
+    }
+
+    // buffer sizes must be set before listen() to apply to the TCP window
+    if (   (set_sockopt_if(listen_sock_fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf) < 0)
+    	|| (set_sockopt_if(listen_sock_fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf) < 0)
+    	|| (set_sockopt_if(listen_sock_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts->defer_accept) < 0)
+    	|| (set_sockopt_if(listen_sock_fd, IPPROTO_TCP, TCP_FASTOPEN, opts->fastopen) < 0)) {
+    	close(listen_sock_fd);
+    	return 0;
+    }
+
     // internet socket address of any host address on specified port
     struct sockaddr_in address;
     socklen_t addrlen = sizeof(address);
@@ -86,33 +134,188 @@ int get_listener_socket(int port) {
 		return 0;
     }
 
-    // set up queue for peer connections up to default
-    // maximum pending socket connections (usually 128)
-    if (listen(listen_sock_fd, SOMAXCONN) < 0) {
+    // set up queue for peer connections; the kernel limits
+    // its length to net.core.somaxconn
+    int backlog = (opts->backlog > 0) ? opts->backlog : DEFAULT_LISTEN_BACKLOG;
+    if (listen(listen_sock_fd, backlog) < 0) {
     	close(listen_sock_fd);
     	return 0;
     }
 
+    // reserve a descriptor for shedding connections
+    reserve_shed_descriptor();
+
 	return listen_sock_fd;
 }
 
 /**
- * Accept new peer connection on a listen socket.
+ * Determine whether a socket file is stale: no server is
+ * listening on it.
+ *
+ * @param address the socket address
+ * @return true if the socket file is stale
+ */
+static bool is_stale_socket(const struct sockaddr_un *address) {
+	struct stat sb;
+	if ((stat(address->sun_path, &sb) != 0) || !S_ISSOCK(sb.st_mode)) {
+		return false;
+	}
+	int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock_fd < 0) {
+		return false;
+	}
+	bool stale = (connect(sock_fd, (const struct sockaddr *)address, sizeof(*address)) != 0)
+			&& (errno == ECONNREFUSED);
+	close(sock_fd);
+	return stale;
+}
+
+/**
+ * Get a UNIX domain stream listener socket bound to a path.
+ * A stale socket file at the path that no server is listening
+ * on is replaced.
+ *
+ * @param path the socket file path
+ * @param opts the listener tuning options; TCP options are ignored
+ * @return listener socket or 0 if unavailable
+ */
+int get_unix_listener_socket(const char *path, const struct listener_options *opts) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	strcpy(address.sun_path, path);
+
+	int listen_sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_sock_fd < 0) {
+		return 0;
+	}
+
+	if (   (set_sockopt_if(listen_sock_fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf) < 0)
+		|| (set_sockopt_if(listen_sock_fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf) < 0)) {
+		close(listen_sock_fd);
+		return 0;
+	}
+
+	// a socket file left by a server that exited does not block bind
+	if (is_stale_socket(&address)) {
+		unlink(path);
+	}
+	if (bind(listen_sock_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		close(listen_sock_fd);
+		return 0;
+	}
+
+	int backlog = (opts->backlog > 0) ? opts->backlog : DEFAULT_LISTEN_BACKLOG;
+	if (listen(listen_sock_fd, backlog) < 0) {
+		close(listen_sock_fd);
+		unlink(path);
+		return 0;
+	}
+
+	reserve_shed_descriptor();
+	return listen_sock_fd;
+}
+
+/**
+ * Reserve a descriptor for shedding connections, if not
+ * already reserved. Listener sockets created by this module
+ * reserve it; a server given its listeners must call this.
+ */
+void reserve_shed_descriptor(void) {
+	if (reserve_fd < 0) {
+		reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	}
+}
+
+/**
+ * Get the address family of a socket.
+ *
+ * @param sock_fd the socket
+ * @return the address family, or -1 with errno set if error
+ */
+int get_socket_family(int sock_fd) {
+	struct sockaddr_storage addr;
+	socklen_t size = sizeof(addr);
+	if (getsockname(sock_fd, (struct sockaddr *)&addr, &size) != 0) {
+		return -1;
+	}
+	return addr.ss_family;
+}
+
+/**
+ * Accept and close one pending connection using the reserved
+ * descriptor. Called when accept fails because the process or
+ * system is out of descriptors.
+ *
+ * @param listen_sock_fd the listen socket
+ */
+void shed_peer_connection(int listen_sock_fd) {
+	// shards share the reserve, so take it atomically
+	int fd = __atomic_exchange_n(&reserve_fd, -1, __ATOMIC_ACQ_REL);
+	if (fd >= 0) {
+		close(fd);
+		// listener may be blocking, so only accept if one is pending
+		struct pollfd pfd = { .fd = listen_sock_fd, .events = POLLIN };
+		if (poll(&pfd, 1, 0) > 0) {
+			int peer_sock_fd = accept4(listen_sock_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (peer_sock_fd >= 0) {
+				close(peer_sock_fd);
+			}
+		}
+		fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			int expected = -1;
+			if (!__atomic_compare_exchange_n(&reserve_fd, &expected, fd,
+					false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				close(fd);
+			}
+		}
+	}
+}
+
+/**
+ * Accept a batch of pending peer connections on a non-blocking
+ * listen socket. Peer sockets are non-blocking and close-on-exec.
+ * If the process is out of descriptors, one pending connection
+ * is accepted and closed using a reserved descriptor so that
+ * the backlog keeps draining.
  *
  * @param listen_sock_fd the listen socket
- * @return the peer socket fd or 0 if unavailable
+ * @param peer_fds array for the accepted peer sockets
+ * @param max the maximum number of connections to accept
+ * @return the number of peer sockets accepted; 0 if none pending
  */
-int accept_peer_connection(int listen_sock_fd) {
-	for (;;) {  // until accepted
-		struct sockaddr_in peer_addr;
-		socklen_t peer_size = sizeof(peer_addr);
-		int peer_sock_fd = accept(listen_sock_fd, (struct sockaddr *)&peer_addr, &peer_size);
-		if (peer_sock_fd > 0) {
-			return peer_sock_fd;
+int accept_peer_connections(int listen_sock_fd, int *peer_fds, int max) {
+	int naccepted = 0;
+	while (naccepted < max) {
+		int peer_sock_fd = accept4(listen_sock_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (peer_sock_fd >= 0) {
+			peer_fds[naccepted++] = peer_sock_fd;
+			continue;
+		}
+		switch (errno) {
+		case EINTR:
+		case ECONNABORTED:
+			continue;
+		case EMFILE:
+		case ENFILE:
+			shed_peer_connection(listen_sock_fd);
+			return naccepted;
+		case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+		case EWOULDBLOCK:
+#endif
+			return naccepted;
+		default:
+			perror("accept");
+			return naccepted;
 		}
-		perror("accept");
 	}
-	return 0;  // keeps compiler happy
+	return naccepted;
 }
 
 /**
@@ -136,23 +339,65 @@ int get_local_host_and_port(int sock_fd, char *host, int *port) {
 }
 
 /**
- * Get the peer host and port for a socket.
+ * Get the peer host and port for a socket. For a UNIX domain
+ * socket, the host is the socket path, "@name" for an abstract
+ * socket, or "unnamed", and the port is 0.
  *
  * @param sock_fd the socket
- * @param host buffer for host IP address string
+ * @param host buffer for host IP address string or socket path;
+ *   must hold at least MAX_HOST_LEN bytes
  * @param port pointer for port value
  * @return 0 if successful
  */
 int get_peer_host_and_port(int sock_fd, char *host, int *port) {
-	struct sockaddr_in addr;
+	struct sockaddr_storage addr;
 	socklen_t size = sizeof(addr);
+	memset(&addr, 0, size);  // socket path may not be terminated
 
 	int status = getpeername(sock_fd, (struct sockaddr *)&addr, &size);
-    if (status == 0) {
-    	*port = ntohs(addr.sin_port);
-    	strcpy(host, inet_ntoa(addr.sin_addr));
-    }
-    return status;
+	if (status != 0) {
+		return status;
+	}
+	switch (addr.ss_family) {
+	case AF_INET:
+		*port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+		inet_ntop(AF_INET, &((struct sockaddr_in *)&addr)->sin_addr, host, MAX_HOST_LEN);
+		break;
+	case AF_INET6:
+		*port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&addr)->sin6_addr, host, MAX_HOST_LEN);
+		break;
+	case AF_UNIX:
+		// peers are usually unbound, so name the listener path instead
+		*port = 0;
+		if (size <= offsetof(struct sockaddr_un, sun_path)) {
+			size = sizeof(addr);
+			status = getsockname(sock_fd, (struct sockaddr *)&addr, &size);
+		}
+		const char *path = ((struct sockaddr_un *)&addr)->sun_path;
+		size_t len = 0;
+		if ((status == 0) && (size > offsetof(struct sockaddr_un, sun_path))) {
+			len = size - offsetof(struct sockaddr_un, sun_path);
+		}
+		if (len == 0) {  // unnamed socket
+			strcpy(host, "unnamed");
+		} else if (path[0] == '\0') {  // abstract socket: show name as "@name"
+			len = (len - 1 < MAX_HOST_LEN - 2) ? len - 1 : MAX_HOST_LEN - 2;
+			host[0] = '@';
+			memcpy(host + 1, path + 1, len);
+			host[len + 1] = '\0';
+		} else {  // path may fill sun_path without a terminator
+			len = strnlen(path, (len < MAX_HOST_LEN - 1) ? len : MAX_HOST_LEN - 1);
+			memcpy(host, path, len);
+			host[len] = '\0';
+		}
+		break;
+	default:
+		*port = 0;
+		strcpy(host, "unknown");
+		break;
+	}
+	return status;
 }
 
 
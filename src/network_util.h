@@ -10,6 +10,32 @@
 #ifndef NETWORK_UTIL_H_
 #define NETWORK_UTIL_H_
 
+#include <stdbool.h>
+
+/** size of a buffer for a peer host address or socket path */
+#define MAX_HOST_LEN 108
+
+/** default length of the listener queue of pending connections */
+#define DEFAULT_LISTEN_BACKLOG 4096
+
+/** tuning options for a listener socket; 0 leaves the system default */
+struct listener_options {
+	/** length of the queue of pending connections */
+	int backlog;
+
+	/** seconds to wait for request bytes before accepting (TCP_DEFER_ACCEPT) */
+	int defer_accept;
+
+	/** length of the queue of TCP Fast Open requests (TCP_FASTOPEN) */
+	int fastopen;
+
+	/** socket receive buffer size inherited by accepted sockets */
+	int rcvbuf;
+
+	/** socket send buffer size inherited by accepted sockets */
+	int sndbuf;
+};
+
 /**
  * Connect to peer at host and port.
  *
@@ -23,17 +49,61 @@ int get_peer_socket(const char *host, int port);
  * Get listener socket
  *
  * @param port the port number
+ * @param reuse_port true to allow several listeners on the port,
+ *   among which the kernel distributes incoming connections
+ * @param opts the listener tuning options
  * @return listener socket or 0 if unavailable
  */
-int get_listener_socket(int port) ;
+int get_listener_socket(int port, bool reuse_port, const struct listener_options *opts);
 
 /**
- * Accept new peer connection on a listen socket.
+ * Get a UNIX domain stream listener socket bound to a path.
+ * A stale socket file at the path that no server is listening
+ * on is replaced.
+ *
+ * @param path the socket file path
+ * @param opts the listener tuning options; TCP options are ignored
+ * @return listener socket or 0 if unavailable
+ */
+int get_unix_listener_socket(const char *path, const struct listener_options *opts);
+
+/**
+ * Reserve a descriptor for shedding connections, if not
+ * already reserved. Listener sockets created by this module
+ * reserve it; a server given its listeners must call this.
+ */
+void reserve_shed_descriptor(void);
+
+/**
+ * Get the address family of a socket.
+ *
+ * @param sock_fd the socket
+ * @return the address family, or -1 with errno set if error
+ */
+int get_socket_family(int sock_fd);
+
+/**
+ * Accept a batch of pending peer connections on a non-blocking
+ * listen socket. Peer sockets are non-blocking and close-on-exec.
+ * If the process is out of descriptors, one pending connection
+ * is accepted and closed using a reserved descriptor so that
+ * the backlog keeps draining.
  *
  * @param listen_sock_fd the listen socket
- * @return the peer socket fd
+ * @param peer_fds array for the accepted peer sockets
+ * @param max the maximum number of connections to accept
+ * @return the number of peer sockets accepted; 0 if none pending
  */
-int accept_peer_connection(int listen_sock_fd);
+int accept_peer_connections(int listen_sock_fd, int *peer_fds, int max);
+
+/**
+ * Accept and close one pending connection using the reserved
+ * descriptor. Called when accept fails because the process or
+ * system is out of descriptors.
+ *
+ * @param listen_sock_fd the listen socket
+ */
+void shed_peer_connection(int listen_sock_fd);
 
 /**
  * Get the local host and port for a socket.
@@ -46,10 +116,13 @@ int accept_peer_connection(int listen_sock_fd);
 int get_local_host_and_port(int sock_fd, char *addr_str, int *port);
 
 /**
- * Get the peer host and port for a socket.
+ * Get the peer host and port for a socket. For a UNIX domain
+ * socket, the host is the socket path, "@name" for an abstract
+ * socket, or "unnamed", and the port is 0.
  *
  * @param sock_fd the socket
- * @param host buffer for host IP address string
+ * @param host buffer for host IP address string or socket path;
+ *   must hold at least MAX_HOST_LEN bytes
  * @param port pointer for port value
  * @return 0 if successful
  */
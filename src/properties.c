@@ -9,7 +9,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include "arena.h"
 #include "http_server.h"
+#include "simd_util.h"
 #include "string_util.h"
 #include "properties.h"
 
@@ -17,40 +19,195 @@
 typedef struct Property {
 	char *name; /** name of property */
 	char *val;  /** value of property */
+	size_t len; /** length of name */
+	size_t vlen; /** length of value */
+	uint32_t hash; /** hash of name ignoring case */
+	size_t next; /** index of next property with same name or SIZE_MAX */
 } Property;
 
-/** Definition of a property list */
+/**
+ * Definition of a property list. Properties are kept in insertion
+ * order, and indexed by an open addressing hash table of distinct
+ * names that is at most half full. Each slot holds the index of
+ * the first property with a name plus 1, or 0 if the slot is empty.
+ */
 typedef struct Properties {
 	Property *props;  			/** array of properties */
 	size_t nprops;				/** number of properties */
 	size_t maxprops;			/** max number of properties */
+	size_t *slots;				/** hash table of first property with each name */
+	size_t nslots;				/** number of slots; a power of 2 */
+	size_t nnames;				/** number of distinct names */
+	struct arena *arena;		/** arena storage is allocated from, or NULL for the heap */
 } Properties;
 
 /**
- * Create a new properties.
- * @return a new properties
+ * Allocate storage for properties. Exits if unavailable.
+ * @param props the properties
+ * @param size the number of bytes
+ * @return the storage
  */
-Properties *newProperties() {
-	Properties *props = malloc(sizeof(Properties));
+static void *propAlloc(Properties *props, size_t size) {
+	void *p = (props->arena != NULL) ? arena_alloc(props->arena, size) : malloc(size);
+	if (p == NULL) {
+		perror("putProperty");
+		exit(1);
+	}
+	return p;
+}
+
+/**
+ * Copy a string to storage for properties. Exits if unavailable.
+ * @param props the properties
+ * @param s the string
+ * @param n the maximum number of bytes to copy
+ * @return the copy
+ */
+static char *propStrndup(Properties *props, const char *s, size_t n) {
+	char *copy = (props->arena != NULL) ? arena_strndup(props->arena, s, n) : strndup(s, n);
+	if (copy == NULL) {
+		perror("putProperty");
+		exit(1);
+	}
+	return copy;
+}
+
+/**
+ * Free storage for properties. Arena storage is
+ * reclaimed when the arena is reset instead.
+ * @param props the properties
+ * @param p the storage
+ */
+static void propFree(Properties *props, void *p) {
+	if (props->arena == NULL) {
+		free(p);
+	}
+}
+
+/**
+ * Hash a name ignoring ASCII case, using FNV-1a.
+ * @param name the name
+ * @param len the length of the name
+ * @return the hash of the name
+ */
+static uint32_t hashName(const char *name, size_t len) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = name[i];
+		hash = (hash ^ (((unsigned)(c - 'A') < 26u) ? c + ('a' - 'A') : c)) * 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Determine whether a property has a name, ignoring case.
+ * @param prop the property
+ * @param name the name
+ * @param len the length of the name
+ * @param hash the hash of the name
+ * @return true if the property has the name
+ */
+static bool hasName(const Property *prop, const char *name, size_t len, uint32_t hash) {
+	return (prop->hash == hash) && (prop->len == len) && str_caseeq(prop->name, name, len);
+}
+
+/**
+ * Find the hash table slot for a name: the slot of the first
+ * property with the name, or the empty slot where it belongs.
+ * @param props the properties
+ * @param name the name
+ * @param len the length of the name
+ * @param hash the hash of the name
+ * @return the slot index
+ */
+static size_t findSlot(const Properties *props, const char *name, size_t len, uint32_t hash) {
+	size_t mask = props->nslots - 1;
+	size_t slot = hash & mask;
+	while (props->slots[slot] != 0 && !hasName(&props->props[props->slots[slot]-1], name, len, hash)) {
+		slot = (slot + 1) & mask;  // linear probing
+	}
+	return slot;
+}
+
+/**
+ * Double the size of the hash table and reinsert the first
+ * property with each name.
+ * @param props the properties
+ */
+static void growSlots(Properties *props) {
+	size_t *oldSlots = props->slots;
+	size_t oldNslots = props->nslots;
+	props->nslots *= 2;
+	props->slots = propAlloc(props, props->nslots*sizeof(size_t));
+	memset(props->slots, 0, props->nslots*sizeof(size_t));
+	size_t mask = props->nslots - 1;
+	for (size_t i = 0; i < oldNslots; i++) {
+		if (oldSlots[i] != 0) {
+			size_t slot = props->props[oldSlots[i]-1].hash & mask;
+			while (props->slots[slot] != 0) {
+				slot = (slot + 1) & mask;
+			}
+			props->slots[slot] = oldSlots[i];
+		}
+	}
+	propFree(props, oldSlots);
+}
+
+/**
+ * Initialize a new properties.
+ * @param props the properties
+ * @param arena the arena to allocate from, or NULL for the heap
+ * @return the properties
+ */
+static Properties *initProperties(Properties *props, struct arena *arena) {
+	props->arena = arena;
 	props->maxprops = 4;
 	props->nprops  = 0;
-	props->props = malloc(props->maxprops*sizeof(Property));
+	props->props = propAlloc(props, props->maxprops*sizeof(Property));
+	props->nslots = 2*props->maxprops;
+	props->nnames = 0;
+	props->slots = propAlloc(props, props->nslots*sizeof(size_t));
+	memset(props->slots, 0, props->nslots*sizeof(size_t));
 	return props;
 }
 
+/**
+ * Create a new properties.
+ * @return a new properties
+ */
+Properties *newProperties() {
+	return initProperties(malloc(sizeof(Properties)), NULL);
+}
+
+/**
+ * Create a new properties whose storage is allocated from an
+ * arena, and reclaimed when the arena is reset.
+ * @param arena the arena
+ * @return a new properties
+ */
+Properties *newArenaProperties(struct arena *arena) {
+	Properties *props = arena_alloc(arena, sizeof(Properties));
+	if (props == NULL) {
+		perror("newArenaProperties");
+		exit(1);
+	}
+	return initProperties(props, arena);
+}
+
 /**
  * Delete a properties
  * @param a properties
  */
 void deleteProperties(Properties *props) {
-	for (int i = 0; i < props->nprops; i++) {
-		free(props->props[i].name);
-		free(props->props[i].val);
+	for (size_t i = 0; i < props->nprops; i++) {
+		propFree(props, props->props[i].name);
+		propFree(props, props->props[i].val);
 	}
 	props->nprops = 0;
 	props->maxprops = 0;
-	free(props->props);
-	free(props);
+	propFree(props, props->props);
+	propFree(props, props->slots);
+	propFree(props, props);
 }
 
 /**
@@ -62,20 +219,60 @@ void deleteProperties(Properties *props) {
  */
 bool putProperty(Properties *props, const char *name, const char *val) {
 	if (props->nprops >= props->maxprops) { // resize if out of space
+		Property *oldProps = props->props;
 		props->maxprops *= 2;
-		props->props = realloc(props->props, props->maxprops*sizeof(Property));
-		if (props->props == NULL) {
-			perror("putProperty");
-			exit(1);
+		props->props = propAlloc(props, props->maxprops*sizeof(Property));
+		memcpy(props->props, oldProps, props->nprops*sizeof(Property));
+		propFree(props, oldProps);
+	}
+	Property *prop = &props->props[props->nprops];
+	prop->name = propStrndup(props, name, MAX_PROP_NAME-1);
+	prop->val = propStrndup(props, val, MAX_PROP_VAL-1);
+	prop->len = strlen(prop->name);
+	prop->vlen = strlen(prop->val);
+	prop->hash = hashName(prop->name, prop->len);
+	prop->next = SIZE_MAX;
+
+	// index a new name, or append to the properties with this name
+	size_t slot = findSlot(props, prop->name, prop->len, prop->hash);
+	if (props->slots[slot] == 0) {
+		props->slots[slot] = props->nprops + 1;
+		if (++props->nnames > props->nslots/2) {
+			growSlots(props);
+		}
+	} else {
+		size_t i = props->slots[slot]-1;
+		while (props->props[i].next != SIZE_MAX) {
+			i = props->props[i].next;
 		}
+		props->props[i].next = props->nprops;
 	}
-	props->props[props->nprops].name = strndup(name, MAX_PROP_NAME-1);
-	props->props[props->nprops].val = strndup(val, MAX_PROP_VAL-1);
 
 	props->nprops++;
 	return true;
 }
 
+/**
+ * Put a property to the properties, replacing the value
+ * of the first property with the same name if present.
+ * @param a properties
+ * @param name a property name
+ * @param val a property value
+ * @return true if property added or replaced
+ */
+bool setProperty(Properties *props, const char *name, const char *val) {
+	size_t len = strlen(name);
+	size_t slot = findSlot(props, name, len, hashName(name, len));
+	if (props->slots[slot] != 0) {
+		Property *prop = &props->props[props->slots[slot]-1];
+		propFree(props, prop->val);
+		prop->val = propStrndup(props, val, MAX_PROP_VAL-1);
+		prop->vlen = strlen(prop->val);
+		return true;
+	}
+	return putProperty(props, name, val);
+}
+
 /**
  * Get name and value for the specified property index.
  * @param props a properties
@@ -85,11 +282,12 @@ bool putProperty(Properties *props, const char *name, const char *val) {
  * @return true if property at specified index is available
  */
 bool getProperty(Properties *props, size_t propIndex, char *name, char *val) {
-	if (propIndex >= props->nprops) {
+	PropertyView view;
+	if (!viewProperty(props, propIndex, &view)) {
 		return false;
 	}
-	strcpy(name, props->props[propIndex].name);
-	strcpy(val, props->props[propIndex].val);
+	memcpy(name, view.name, view.nameLen+1);
+	memcpy(val, view.val, view.valLen+1);
 	return true;
 }
 
@@ -102,14 +300,92 @@ bool getProperty(Properties *props, size_t propIndex, char *name, char *val) {
  * @return the index of the value found or SIZE_MAX if not found
  */
 size_t findProperty(Properties *props, size_t propIndex, const char *name, char *val) {
-	while (propIndex < props->nprops) {
-		if (strcasecmp(name, props->props[propIndex].name) == 0) {
-			strcpy(val, props->props[propIndex].val);
-			return propIndex;
-		}
-		propIndex++;
+	PropertyView view;
+	size_t i = findPropertyView(props, propIndex, name, &view);
+	if (i != SIZE_MAX) {
+		memcpy(val, view.val, view.valLen+1);
+	}
+	return i;
+}
+
+/**
+ * View the property at the specified property index.
+ * @param props a properties
+ * @param propIndex the property index
+ * @param view storage for the view
+ * @return true if property at specified index is available
+ */
+bool viewProperty(const Properties *props, size_t propIndex, PropertyView *view) {
+	if (propIndex >= props->nprops) {
+		return false;
+	}
+	const Property *prop = &props->props[propIndex];
+	view->name = prop->name;
+	view->nameLen = prop->len;
+	view->val = prop->val;
+	view->valLen = prop->vlen;
+	return true;
+}
+
+/**
+ * Find a property by name, starting with specified property
+ * index, and view it.
+ * @param props the properties
+ * @param propIndex the starting property index
+ * @param name prop name
+ * @param view storage for the view
+ * @return the index of the property found or SIZE_MAX if not found
+ */
+size_t findPropertyView(const Properties *props, size_t propIndex, const char *name, PropertyView *view) {
+	size_t len = strlen(name);
+	size_t slot = findSlot(props, name, len, hashName(name, len));
+	if (props->slots[slot] == 0) {
+		return SIZE_MAX;
+	}
+	// properties with the name are chained in index order
+	size_t i = props->slots[slot]-1;
+	while (i != SIZE_MAX && i < propIndex) {
+		i = props->props[i].next;
+	}
+	if (i != SIZE_MAX) {
+		viewProperty(props, i, view);
+	}
+	return i;
+}
+
+/**
+ * Get the value of the first property with a name.
+ * @param props the properties
+ * @param name prop name
+ * @return the value, valid as for a view, or NULL if not found
+ */
+const char *findPropertyValue(const Properties *props, const char *name) {
+	PropertyView view;
+	return (findPropertyView(props, 0, name, &view) != SIZE_MAX) ? view.val : NULL;
+}
+
+/**
+ * Start iterating over properties.
+ * @param props the properties
+ * @param iter the iterator
+ */
+void startProperties(const Properties *props, PropertyIterator *iter) {
+	iter->props = props;
+	iter->propIndex = 0;
+}
+
+/**
+ * View the next property of an iteration.
+ * @param iter the iterator
+ * @param view storage for the view
+ * @return true if there was a next property
+ */
+bool nextProperty(PropertyIterator *iter, PropertyView *view) {
+	if (!viewProperty(iter->props, iter->propIndex, view)) {
+		return false;
 	}
-	return SIZE_MAX;
+	iter->propIndex++;
+	return true;
 }
 
 /**
@@ -192,11 +468,10 @@ int loadProperties(const char *propFile, Properties *props) {
 char ** toPropertiesArray(Properties *props) {
 	size_t nprops = nProperties(props);
 	char** propsArray = malloc((nprops+1)*sizeof(char*));
-	char key[MAXBUF], value[MAXBUF];
-	for (int i = 0; i < nprops; i++) {
-		getProperty(props, i, key, value);
-		propsArray[i] = malloc(strlen(key) + strlen(value) + 2);
-		sprintf(propsArray[i], "%s=%s", key, value);
+	PropertyView view;
+	for (int i = 0; viewProperty(props, i, &view); i++) {
+		propsArray[i] = malloc(view.nameLen + view.valLen + 2);
+		sprintf(propsArray[i], "%s=%s", view.name, view.val);
 	}
 	propsArray[nprops] = NULL;
 
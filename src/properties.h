@@ -10,6 +10,7 @@
 #ifndef PROPERTIES_H_
 #define PROPERTIES_H_
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_PROP_NAME 64
@@ -18,12 +19,40 @@
 /** Declaration of Properties as opaque type */
 typedef struct Properties Properties;
 
+/**
+ * View of a property without copying it. The strings are
+ * terminated, and valid until the properties are deleted
+ * or the property value is replaced.
+ */
+typedef struct PropertyView {
+	const char *name;	/** name of property */
+	size_t nameLen;		/** length of name */
+	const char *val;	/** value of property */
+	size_t valLen;		/** length of value */
+} PropertyView;
+
+/** Iterator over properties in the order they were put */
+typedef struct PropertyIterator {
+	const Properties *props;	/** properties being iterated */
+	size_t propIndex;			/** index of next property */
+} PropertyIterator;
+
+struct arena;
+
 /**
  * Create a new properties.
  * @return a new properties
  */
 Properties *newProperties();
 
+/**
+ * Create a new properties whose storage is allocated from an
+ * arena, and reclaimed when the arena is reset.
+ * @param arena the arena
+ * @return a new properties
+ */
+Properties *newArenaProperties(struct arena *arena);
+
 /**
  * Delete a properties
  * @param a properties
@@ -39,6 +68,16 @@ void deleteProperties(Properties *props);
  */
 bool putProperty(Properties *props, const char *name, const char *val);
 
+/**
+ * Put a property to the properties, replacing the value
+ * of the first property with the same name if present.
+ * @param a properties
+ * @param name a property name
+ * @param val a property value
+ * @return true if property added or replaced
+ */
+bool setProperty(Properties *props, const char *name, const char *val);
+
 /**
  * Get name and value for the specified property index.
  * @param props a properties
@@ -59,6 +98,49 @@ bool getProperty(Properties *props, size_t propIndex, char *name, char *val);
  */
 size_t findProperty(Properties *props, size_t propIndex, const char *name, char *val);
 
+/**
+ * View the property at the specified property index.
+ * @param props a properties
+ * @param propIndex the property index
+ * @param view storage for the view
+ * @return true if property at specified index is available
+ */
+bool viewProperty(const Properties *props, size_t propIndex, PropertyView *view);
+
+/**
+ * Find a property by name, starting with specified property
+ * index, and view it.
+ * @param props the properties
+ * @param propIndex the starting property index
+ * @param name prop name
+ * @param view storage for the view
+ * @return the index of the property found or SIZE_MAX if not found
+ */
+size_t findPropertyView(const Properties *props, size_t propIndex, const char *name, PropertyView *view);
+
+/**
+ * Get the value of the first property with a name.
+ * @param props the properties
+ * @param name prop name
+ * @return the value, valid as for a view, or NULL if not found
+ */
+const char *findPropertyValue(const Properties *props, const char *name);
+
+/**
+ * Start iterating over properties.
+ * @param props the properties
+ * @param iter the iterator
+ */
+void startProperties(const Properties *props, PropertyIterator *iter);
+
+/**
+ * View the next property of an iteration.
+ * @param iter the iterator
+ * @param view storage for the view
+ * @return true if there was a next property
+ */
+bool nextProperty(PropertyIterator *iter, PropertyView *view);
+
 /**
  * Return number of properties.
  * @param props the properties
@@ -0,0 +1,221 @@
+/*
+ * restart.c
+ *
+ * Zero-downtime restart: a running server starts a new binary
+ * and hands it the listener sockets over a UNIX socket pair with
+ * SCM_RIGHTS, so no pending connection is dropped. The old server
+ * stops accepting once the new one reports that it is accepting.
+ *
+ *  @since 2020-04-22
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "restart.h"
+
+/** milliseconds to wait for a new server to start accepting */
+#define RESTART_READY_TIMEOUT 10000
+
+/** handoff socket of the server that started this one, or -1 if none */
+static int handoff_fd = -1;
+
+/**
+ * Receive the listener sockets handed off by the server that
+ * started this one, if any.
+ *
+ * @param listen_fds the array for the listener sockets
+ * @param max the maximum number of listener sockets to use; any
+ *   more that are received are closed
+ * @return the number of listener sockets received, 0 if this server
+ *   was not started by another, or -1 with errno set if error
+ */
+int restart_inherit_listeners(int *listen_fds, int max) {
+	const char *env = getenv(RESTART_HANDOFF_ENV);
+	if (env == NULL) {
+		return 0;
+	}
+	handoff_fd = atoi(env);
+	unsetenv(RESTART_HANDOFF_ENV);
+	fcntl(handoff_fd, F_SETFD, FD_CLOEXEC);
+
+	char count;
+	struct iovec iov = { .iov_base = &count, .iov_len = 1 };
+	char control[CMSG_SPACE(RESTART_MAX_LISTENERS * sizeof(int))];
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control, .msg_controllen = sizeof(control)
+	};
+	ssize_t nread;
+	while ((nread = recvmsg(handoff_fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+	}
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (nread != 1 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+		if (nread >= 0) {
+			errno = EPROTO;
+		}
+		return -1;
+	}
+
+	int nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	int *fds = (int *)CMSG_DATA(cmsg);
+	for (int i = 0; i < nfds; i++) {
+		if (i < max) {
+			listen_fds[i] = fds[i];
+		} else {
+			close(fds[i]);
+		}
+	}
+	return (nfds < max) ? nfds : max;
+}
+
+/**
+ * Report to the server that started this one that this server
+ * is accepting connections, so that the old server can stop.
+ * Does nothing if this server was not started by another.
+ */
+void restart_ready(void) {
+	if (handoff_fd < 0) {
+		return;
+	}
+	char ready = 1;
+	if (write(handoff_fd, &ready, 1) != 1) {
+		perror("restart_ready");
+	}
+	close(handoff_fd);
+	handoff_fd = -1;
+}
+
+/**
+ * Build the environment of a new server: the environment of
+ * this one with the handoff socket of the new server added.
+ *
+ * @param fd the handoff socket of the new server
+ * @return the environment or NULL if unavailable
+ */
+static char **handoff_environ(int fd) {
+	extern char **environ;
+	size_t n = 0;
+	while (environ[n] != NULL) {
+		n++;
+	}
+	char **envp = malloc((n + 2) * sizeof(char *));
+	static char handoff[sizeof(RESTART_HANDOFF_ENV) + 16];
+	if (envp == NULL) {
+		return NULL;
+	}
+	memcpy(envp, environ, n * sizeof(char *));
+	snprintf(handoff, sizeof(handoff), "%s=%d", RESTART_HANDOFF_ENV, fd);
+	envp[n] = handoff;
+	envp[n + 1] = NULL;
+	return envp;
+}
+
+/**
+ * Send the listener sockets to a new server.
+ *
+ * @param fd the handoff socket
+ * @param listen_fds the listener sockets
+ * @param nfds the number of listener sockets
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int send_listeners(int fd, const int *listen_fds, int nfds) {
+	char count = (char)nfds;
+	struct iovec iov = { .iov_base = &count, .iov_len = 1 };
+	char control[CMSG_SPACE(RESTART_MAX_LISTENERS * sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control, .msg_controllen = CMSG_SPACE(nfds * sizeof(int))
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), listen_fds, nfds * sizeof(int));
+
+	ssize_t nsent;
+	while ((nsent = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+	}
+	return (nsent == 1) ? 0 : -1;
+}
+
+/**
+ * Wait for a new server to report that it is accepting connections.
+ *
+ * @param fd the handoff socket
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int wait_ready(int fd) {
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int nready;
+	while ((nready = poll(&pfd, 1, RESTART_READY_TIMEOUT)) < 0 && errno == EINTR) {
+	}
+	if (nready == 0) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	char ready;
+	ssize_t nread = read(fd, &ready, 1);
+	if (nread == 0) {  // new server exited before it was ready
+		errno = ECHILD;
+	}
+	return (nread == 1) ? 0 : -1;
+}
+
+/**
+ * Start a new server binary with the same arguments, hand it the
+ * listener sockets, and wait for it to report that it is accepting
+ * connections.
+ *
+ * @param argv the arguments of this server; argv[0] is the binary
+ * @param listen_fds the listener sockets
+ * @param nfds the number of listener sockets
+ * @return 0 if the new server is accepting, -1 with errno set if error
+ */
+int restart_exec(char *const argv[], const int *listen_fds, int nfds) {
+	if (nfds > RESTART_MAX_LISTENERS) {
+		errno = EINVAL;
+		return -1;
+	}
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+		return -1;
+	}
+	char **envp = handoff_environ(sv[1]);
+	if (envp == NULL) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	// child only clears close-on-exec of its handoff socket before exec
+	pid_t pid = fork();
+	if (pid == 0) {
+		fcntl(sv[1], F_SETFD, 0);
+		execvpe(argv[0], argv, envp);
+		_exit(127);
+	}
+	free(envp);
+	close(sv[1]);
+	if (pid < 0) {
+		close(sv[0]);
+		return -1;
+	}
+
+	int status = send_listeners(sv[0], listen_fds, nfds);
+	if (status == 0) {
+		status = wait_ready(sv[0]);
+	}
+	int err = errno;
+	close(sv[0]);
+	errno = err;
+	return status;
+}
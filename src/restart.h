@@ -0,0 +1,52 @@
+/*
+ * restart.h
+ *
+ * Zero-downtime restart: a running server starts a new binary
+ * and hands it the listener sockets over a UNIX socket pair with
+ * SCM_RIGHTS, so no pending connection is dropped. The old server
+ * stops accepting once the new one reports that it is accepting.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef RESTART_H_
+#define RESTART_H_
+
+/** environment variable naming the handoff socket of a new server */
+#define RESTART_HANDOFF_ENV "HTTPD_HANDOFF_FD"
+
+/** maximum number of listener sockets handed off */
+#define RESTART_MAX_LISTENERS 253
+
+/**
+ * Receive the listener sockets handed off by the server that
+ * started this one, if any.
+ *
+ * @param listen_fds the array for the listener sockets
+ * @param max the maximum number of listener sockets to use; any
+ *   more that are received are closed
+ * @return the number of listener sockets received, 0 if this server
+ *   was not started by another, or -1 with errno set if error
+ */
+int restart_inherit_listeners(int *listen_fds, int max);
+
+/**
+ * Report to the server that started this one that this server
+ * is accepting connections, so that the old server can stop.
+ * Does nothing if this server was not started by another.
+ */
+void restart_ready(void);
+
+/**
+ * Start a new server binary with the same arguments, hand it the
+ * listener sockets, and wait for it to report that it is accepting
+ * connections.
+ *
+ * @param argv the arguments of this server; argv[0] is the binary
+ * @param listen_fds the listener sockets
+ * @param nfds the number of listener sockets
+ * @return 0 if the new server is accepting, -1 with errno set if error
+ */
+int restart_exec(char *const argv[], const int *listen_fds, int nfds);
+
+#endif /* RESTART_H_ */
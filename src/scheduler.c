@@ -0,0 +1,439 @@
+/*
+ * scheduler.c
+ *
+ * Work-stealing scheduler that runs request work on a fixed
+ * set of worker threads. Each worker has its own queue; idle
+ * workers steal from a randomly chosen victim.
+ *
+ * Work is added to the workers' queues in turn. The queues are
+ * bounded lock-free rings that are allocated once, so adding or
+ * taking work needs no lock or allocation, and a worker is only
+ * signalled when one is sleeping. Workers and thieves both take
+ * the oldest work, so requests are served in arrival order.
+ *
+ *  @since 2020-04-22
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scheduler.h"
+
+/** capacity of a worker queue; must be a power of 2 */
+#define QUEUE_CAPACITY SCHEDULER_QUEUE_CAPACITY
+
+/** cache line size used to keep workers from sharing lines */
+#define CACHE_LINE_SIZE 64
+
+/** a unit of work */
+struct work {
+	/** the work function */
+	void (*function)(void *);
+
+	/** the argument to the work function */
+	void *arg;
+};
+
+/**
+ * A slot of a work queue. The sequence number tells producers
+ * and consumers whether the slot is free or holds work for the
+ * position they claim.
+ */
+struct slot {
+	/** sequence number of the slot */
+	unsigned long seq;
+
+	/** the work in the slot */
+	struct work work;
+};
+
+/**
+ * Bounded lock-free queue of work that any thread can add to and
+ * take from, after D. Vyukov's bounded MPMC queue. The positions
+ * are on separate cache lines so that producers and consumers do
+ * not invalidate each other's line.
+ */
+struct work_queue {
+	/** the slots */
+	struct slot *slots;
+
+	/** position of the next work to add */
+	unsigned long enqueue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+
+	/** position of the next work to take */
+	unsigned long dequeue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/** a worker thread and its queues */
+struct worker {
+	/** the work queue */
+	struct work_queue queue;
+
+	/** queue of work that only this worker may run */
+	struct work_queue pinned;
+
+	/** index of the worker in the scheduler */
+	int id;
+
+	/** the scheduler of the worker */
+	struct scheduler *sched;
+
+	/** the worker thread */
+	pthread_t thread;
+
+	/** state of the random victim generator */
+	unsigned seed;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/** a scheduler and its worker threads */
+struct scheduler {
+	/** the workers */
+	struct worker *workers;
+
+	/** number of workers */
+	int nworkers;
+
+	/** worker that receives the next work */
+	unsigned next;
+
+	/** lock for sleeping workers */
+	pthread_mutex_t idle_lock;
+
+	/** condition that wakes sleeping workers */
+	pthread_cond_t idle_cond;
+
+	/** number of sleeping workers, also read without the lock */
+	int nidle;
+
+	/** true when workers should exit once their queues are empty */
+	bool shutdown;
+};
+
+/** worker running on the current thread */
+static __thread struct worker *current_worker;
+
+/**
+ * Initialize a work queue with empty slots.
+ *
+ * @param queue the queue
+ * @return 0 if successful, -1 if out of memory
+ */
+static int init_queue(struct work_queue *queue) {
+	queue->slots = malloc(QUEUE_CAPACITY * sizeof(struct slot));
+	if (queue->slots == NULL) {
+		return -1;
+	}
+	for (unsigned long i = 0; i < QUEUE_CAPACITY; i++) {
+		queue->slots[i].seq = i;
+	}
+	queue->enqueue_pos = queue->dequeue_pos = 0;
+	return 0;
+}
+
+/**
+ * Add work to the back of a queue.
+ *
+ * @param queue the queue
+ * @param work the work
+ * @return true if added, false if queue is full
+ */
+static bool push_work(struct work_queue *queue, const struct work *work) {
+	struct slot *slot;
+	unsigned long pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+	while (true) {
+		slot = &queue->slots[pos & (QUEUE_CAPACITY - 1)];
+		unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)seq - (long)pos;
+		if (diff == 0) {  // slot is free: claim its position
+			if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {  // slot still holds work from the last lap
+			return false;
+		} else {  // another producer claimed the position
+			pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	slot->work = *work;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * Take the oldest work from the front of a queue.
+ *
+ * @param queue the queue
+ * @param work the work taken
+ * @return true if work was taken, false if queue is empty
+ */
+static bool take_work(struct work_queue *queue, struct work *work) {
+	struct slot *slot;
+	unsigned long pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+	while (true) {
+		slot = &queue->slots[pos & (QUEUE_CAPACITY - 1)];
+		unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		long diff = (long)seq - (long)(pos + 1);
+		if (diff == 0) {  // slot holds work: claim its position
+			if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {  // slot not yet filled
+			return false;
+		} else {  // another consumer claimed the position
+			pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	*work = slot->work;
+	__atomic_store_n(&slot->seq, pos + QUEUE_CAPACITY, __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * Determine whether a queue has work that was claimed by a producer.
+ *
+ * @param queue the queue
+ * @return true if the queue is not empty
+ */
+static bool queue_has_work(struct work_queue *queue) {
+	return __atomic_load_n(&queue->enqueue_pos, __ATOMIC_SEQ_CST)
+			!= __atomic_load_n(&queue->dequeue_pos, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Steal work from the other workers, starting with a random victim.
+ *
+ * @param self the stealing worker
+ * @param work the work stolen
+ * @return true if work was stolen
+ */
+static bool steal_work(struct worker *self, struct work *work) {
+	struct scheduler *sched = self->sched;
+	int start = rand_r(&self->seed) % sched->nworkers;
+	for (int i = 0; i < sched->nworkers; i++) {
+		struct worker *victim = &sched->workers[(start + i) % sched->nworkers];
+		if (victim != self && take_work(&victim->queue, work)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Determine whether there is work that a worker can run.
+ *
+ * @param self the worker
+ * @return true if there is queued work
+ */
+static bool has_work(struct worker *self) {
+	struct scheduler *sched = self->sched;
+	if (queue_has_work(&self->pinned)) {
+		return true;
+	}
+	for (int i = 0; i < sched->nworkers; i++) {
+		if (queue_has_work(&sched->workers[i].queue)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Worker thread runs its own work, then stolen work, and
+ * sleeps when there is no work to do.
+ *
+ * @param arg the worker
+ * @return NULL
+ */
+static void *run_worker(void *arg) {
+	struct worker *self = arg;
+	struct scheduler *sched = self->sched;
+	current_worker = self;
+
+	while (true) {
+		// pinned work continues requests that are already under way
+		struct work work;
+		if (take_work(&self->pinned, &work)
+			|| take_work(&self->queue, &work)
+			|| steal_work(self, &work)) {
+			work.function(work.arg);
+			continue;
+		}
+
+		// counting this worker as idle before checking for work ensures
+		// that a worker adding work after the check will wake it
+		pthread_mutex_lock(&sched->idle_lock);
+		__atomic_add_fetch(&sched->nidle, 1, __ATOMIC_SEQ_CST);
+		while (!sched->shutdown && !has_work(self)) {
+			pthread_cond_wait(&sched->idle_cond, &sched->idle_lock);
+		}
+		__atomic_sub_fetch(&sched->nidle, 1, __ATOMIC_SEQ_CST);
+		bool stop = sched->shutdown && !has_work(self);
+		pthread_mutex_unlock(&sched->idle_lock);
+		if (stop) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Stop the running worker threads once queued work is done,
+ * and free the scheduler and its workers.
+ *
+ * @param sched the scheduler
+ * @param nrunning the number of running worker threads
+ */
+static void destroy_workers(struct scheduler *sched, int nrunning) {
+	pthread_mutex_lock(&sched->idle_lock);
+	sched->shutdown = true;
+	pthread_cond_broadcast(&sched->idle_cond);
+	pthread_mutex_unlock(&sched->idle_lock);
+
+	for (int i = 0; i < nrunning; i++) {
+		pthread_join(sched->workers[i].thread, NULL);
+	}
+	for (int i = 0; i < sched->nworkers; i++) {
+		free(sched->workers[i].queue.slots);
+		free(sched->workers[i].pinned.slots);
+	}
+	pthread_cond_destroy(&sched->idle_cond);
+	pthread_mutex_destroy(&sched->idle_lock);
+	free(sched->workers);
+	free(sched);
+}
+
+/**
+ * Create a scheduler and start its worker threads.
+ *
+ * @param nthreads the number of worker threads
+ * @return the scheduler or NULL if unavailable
+ */
+struct scheduler *scheduler_init(int nthreads) {
+	struct scheduler *sched = calloc(1, sizeof(struct scheduler));
+	if (sched == NULL) {
+		return NULL;
+	}
+	sched->workers = aligned_alloc(CACHE_LINE_SIZE, nthreads * sizeof(struct worker));
+	if (sched->workers == NULL) {
+		free(sched);
+		return NULL;
+	}
+	memset(sched->workers, 0, nthreads * sizeof(struct worker));
+	pthread_mutex_init(&sched->idle_lock, NULL);
+	pthread_cond_init(&sched->idle_cond, NULL);
+
+	// queues are all ready before any worker can steal from them
+	sched->nworkers = nthreads;
+	for (int i = 0; i < nthreads; i++) {
+		struct worker *worker = &sched->workers[i];
+		worker->sched = sched;
+		worker->id = i;
+		worker->seed = i + 1;
+		if (init_queue(&worker->queue) != 0 || init_queue(&worker->pinned) != 0) {
+			sched->nworkers = i + 1;
+			destroy_workers(sched, 0);
+			return NULL;
+		}
+	}
+	for (int i = 0; i < nthreads; i++) {
+		if (pthread_create(&sched->workers[i].thread, NULL, run_worker, &sched->workers[i]) != 0) {
+			destroy_workers(sched, i);
+			return NULL;
+		}
+	}
+	return sched;
+}
+
+/**
+ * Add work to the scheduler. Work is queued on one of the
+ * workers in turn, and may be stolen by another idle worker.
+ * If that worker's queue is full, the next one is tried.
+ *
+ * @param sched the scheduler
+ * @param function the work function
+ * @param arg the argument to the work function
+ * @return 0 if successful, -1 if all queues are full
+ */
+int scheduler_add_work(struct scheduler *sched, void (*function)(void *), void *arg) {
+	struct work work = { .function = function, .arg = arg };
+	unsigned next = __atomic_fetch_add(&sched->next, 1, __ATOMIC_RELAXED);
+	int i;
+	for (i = 0; i < sched->nworkers; i++) {
+		if (push_work(&sched->workers[(next + i) % sched->nworkers].queue, &work)) {
+			break;
+		}
+	}
+	if (i == sched->nworkers) {
+		return -1;
+	}
+
+	// wake a sleeping worker; any worker can steal the work. The fence
+	// orders the add before reading the count of sleeping workers, which
+	// they increment before checking for work
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sched->nidle, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&sched->idle_lock);
+		pthread_cond_signal(&sched->idle_cond);
+		pthread_mutex_unlock(&sched->idle_lock);
+	}
+	return 0;
+}
+
+/**
+ * Add work that must run on a particular worker, such as
+ * resuming a coroutine that the worker created.
+ *
+ * @param sched the scheduler
+ * @param worker the index of the worker
+ * @param function the work function
+ * @param arg the argument to the work function
+ * @return 0 if successful, -1 if the worker's pinned queue is full
+ */
+int scheduler_add_pinned_work(struct scheduler *sched, int worker,
+		void (*function)(void *), void *arg) {
+	struct work work = { .function = function, .arg = arg };
+	if (!push_work(&sched->workers[worker].pinned, &work)) {
+		return -1;
+	}
+
+	// only the one worker can run the work, so wake all sleeping workers
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sched->nidle, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&sched->idle_lock);
+		pthread_cond_broadcast(&sched->idle_cond);
+		pthread_mutex_unlock(&sched->idle_lock);
+	}
+	return 0;
+}
+
+/**
+ * Get the index of the worker running on the calling thread.
+ *
+ * @return the index of the worker, or -1 if not a worker thread
+ */
+int scheduler_worker_id(void) {
+	return (current_worker != NULL) ? current_worker->id : -1;
+}
+
+/**
+ * Get the number of worker threads of a scheduler.
+ *
+ * @param sched the scheduler
+ * @return the number of worker threads
+ */
+int scheduler_worker_count(struct scheduler *sched) {
+	return sched->nworkers;
+}
+
+/**
+ * Stop the worker threads once queued work is done,
+ * and free the scheduler.
+ *
+ * @param sched the scheduler
+ */
+void scheduler_destroy(struct scheduler *sched) {
+	destroy_workers(sched, sched->nworkers);
+}
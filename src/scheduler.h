@@ -0,0 +1,76 @@
+/*
+ * scheduler.h
+ *
+ * Work-stealing scheduler that runs request work on a fixed
+ * set of worker threads. Each worker has its own queue; idle
+ * workers steal from a randomly chosen victim.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+/** capacity of each worker's queues; a power of 2 */
+#define SCHEDULER_QUEUE_CAPACITY 1024
+
+/** a scheduler and its worker threads */
+struct scheduler;
+
+/**
+ * Create a scheduler and start its worker threads.
+ *
+ * @param nthreads the number of worker threads
+ * @return the scheduler or NULL if unavailable
+ */
+struct scheduler *scheduler_init(int nthreads);
+
+/**
+ * Add work to the scheduler. Work is queued on one of the
+ * workers in turn, and may be stolen by another idle worker.
+ * If that worker's queue is full, the next one is tried.
+ *
+ * @param sched the scheduler
+ * @param function the work function
+ * @param arg the argument to the work function
+ * @return 0 if successful, -1 if all queues are full
+ */
+int scheduler_add_work(struct scheduler *sched, void (*function)(void *), void *arg);
+
+/**
+ * Add work that must run on a particular worker, such as
+ * resuming a coroutine that the worker created.
+ *
+ * @param sched the scheduler
+ * @param worker the index of the worker
+ * @param function the work function
+ * @param arg the argument to the work function
+ * @return 0 if successful, -1 if the worker's pinned queue is full
+ */
+int scheduler_add_pinned_work(struct scheduler *sched, int worker,
+		void (*function)(void *), void *arg);
+
+/**
+ * Get the index of the worker running on the calling thread.
+ *
+ * @return the index of the worker, or -1 if not a worker thread
+ */
+int scheduler_worker_id(void);
+
+/**
+ * Get the number of worker threads of a scheduler.
+ *
+ * @param sched the scheduler
+ * @return the number of worker threads
+ */
+int scheduler_worker_count(struct scheduler *sched);
+
+/**
+ * Stop the worker threads once queued work is done,
+ * and free the scheduler.
+ *
+ * @param sched the scheduler
+ */
+void scheduler_destroy(struct scheduler *sched);
+
+#endif /* SCHEDULER_H_ */
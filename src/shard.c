@@ -0,0 +1,160 @@
+/*
+ * shard.c
+ *
+ * Per-core shards, each with its own SO_REUSEPORT listener,
+ * event loop, and worker threads pinned to the shard's core.
+ * The kernel distributes connections among the listeners, so
+ * a connection is accepted and processed on a single core.
+ * A server without shards runs as a single unpinned shard.
+ *
+ *  @since 2020-04-22
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "shard.h"
+#include "scheduler.h"
+
+/**
+ * Get the cpu for a shard from the cpus available to the server.
+ *
+ * @param id the shard number
+ * @return the cpu number or -1 if unavailable
+ */
+static int get_shard_cpu(int id) {
+	cpu_set_t cpus;
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+		return -1;
+	}
+	int ncpus = CPU_COUNT(&cpus);
+	int nth = id % ncpus;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &cpus) && nth-- == 0) {
+			return cpu;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Get the number of cpus available to the server.
+ *
+ * @return the number of cpus
+ */
+int shard_cpu_count(void) {
+	cpu_set_t cpus;
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+		return 1;
+	}
+	return CPU_COUNT(&cpus);
+}
+
+/**
+ * Shard thread pins itself to the shard cpu and runs the event loop.
+ * Worker threads created by this thread inherit its cpu affinity,
+ * and connection buffers allocated by the loop are first touched
+ * on this cpu, so they are placed on its local NUMA node.
+ *
+ * @param arg the shard
+ * @return NULL
+ */
+static void *run_shard(void *arg) {
+	struct shard *shard = arg;
+
+	if (shard->cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(shard->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+			fprintf(stderr, "shard %d: cannot pin to cpu %d\n", shard->id, shard->cpu);
+		}
+	}
+
+	struct scheduler *sched = scheduler_init(shard->nthreads);
+	if (sched == NULL) {
+		perror("scheduler_init");
+		exit(EXIT_FAILURE);
+	}
+	if (event_loop_init(&shard->loop, shard->listen_fd, shard->unix_fd, sched) != 0) {
+		perror("event_loop_init");
+		exit(EXIT_FAILURE);
+	}
+	pthread_barrier_wait(shard->started);
+	event_loop_run(&shard->loop);
+
+	// workers may still hold connections if the drain timed out
+	if (__atomic_load_n(&shard->loop.nconnections, __ATOMIC_RELAXED) == 0) {
+		scheduler_destroy(sched);
+	}
+	return NULL;
+}
+
+/**
+ * Create shards, each with its own listener, and start their
+ * event loops. Worker threads are divided evenly between the
+ * shards. Returns once all event loops are initialized.
+ *
+ * @param nshards the number of shards
+ * @param listen_fds the listener socket of each shard
+ * @param unix_fd the UNIX domain listener socket shared by all shards, or -1 if none
+ * @param nthreads the total number of worker threads
+ * @param pin true to pin each shard to its own cpu
+ * @return the array of shards, or NULL if error
+ */
+struct shard *start_shards(int nshards, const int *listen_fds, int unix_fd, int nthreads, bool pin) {
+	struct shard *shards = calloc(nshards, sizeof(struct shard));
+	if (shards == NULL) {
+		return NULL;
+	}
+
+	pthread_barrier_t started;
+	pthread_barrier_init(&started, NULL, nshards + 1);
+	for (int i = 0; i < nshards; i++) {
+		shards[i].id = i;
+		shards[i].cpu = pin ? get_shard_cpu(i) : -1;
+		shards[i].nthreads = (nthreads + nshards - 1 - i) / nshards;
+		if (shards[i].nthreads < 1) {
+			shards[i].nthreads = 1;
+		}
+		shards[i].listen_fd = listen_fds[i];
+		shards[i].unix_fd = unix_fd;
+		shards[i].started = &started;
+		if (pthread_create(&shards[i].thread, NULL, run_shard, &shards[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// event loops must exist before they can be drained
+	pthread_barrier_wait(&started);
+	pthread_barrier_destroy(&started);
+	return shards;
+}
+
+/**
+ * Make shard event loops stop accepting connections and drain.
+ *
+ * @param shards the array of shards
+ * @param nshards the number of shards
+ */
+void drain_shards(struct shard *shards, int nshards) {
+	for (int i = 0; i < nshards; i++) {
+		event_loop_drain(&shards[i].loop);
+	}
+}
+
+/**
+ * Wait for shard event loops to exit, and close their listeners.
+ *
+ * @param shards the array of shards
+ * @param nshards the number of shards
+ */
+void join_shards(struct shard *shards, int nshards) {
+	for (int i = 0; i < nshards; i++) {
+		pthread_join(shards[i].thread, NULL);
+		close(shards[i].listen_fd);
+	}
+}
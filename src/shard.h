@@ -0,0 +1,81 @@
+/*
+ * shard.h
+ *
+ * Per-core shards, each with its own SO_REUSEPORT listener,
+ * event loop, and worker threads pinned to the shard's core.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "event_loop.h"
+
+/** a shard of the server */
+struct shard {
+	/** shard number */
+	int id;
+
+	/** cpu the shard threads are pinned to */
+	int cpu;
+
+	/** the listener socket of the shard */
+	int listen_fd;
+
+	/** the UNIX domain listener socket shared by all shards, or -1 if none */
+	int unix_fd;
+
+	/** number of worker threads of the shard */
+	int nthreads;
+
+	/** the shard event loop */
+	struct event_loop loop;
+
+	/** barrier reached by each shard once its event loop is initialized */
+	pthread_barrier_t *started;
+
+	/** thread running the event loop */
+	pthread_t thread;
+};
+
+/**
+ * Get the number of cpus available to the server.
+ *
+ * @return the number of cpus
+ */
+int shard_cpu_count(void);
+
+/**
+ * Create shards, each with its own listener, and start their
+ * event loops. Worker threads are divided evenly between the
+ * shards. Returns once all event loops are initialized.
+ *
+ * @param nshards the number of shards
+ * @param listen_fds the listener socket of each shard
+ * @param unix_fd the UNIX domain listener socket shared by all shards, or -1 if none
+ * @param nthreads the total number of worker threads
+ * @param pin true to pin each shard to its own cpu
+ * @return the array of shards, or NULL if error
+ */
+struct shard *start_shards(int nshards, const int *listen_fds, int unix_fd, int nthreads, bool pin);
+
+/**
+ * Make shard event loops stop accepting connections and drain.
+ *
+ * @param shards the array of shards
+ * @param nshards the number of shards
+ */
+void drain_shards(struct shard *shards, int nshards);
+
+/**
+ * Wait for shard event loops to exit, and close their listeners.
+ *
+ * @param shards the array of shards
+ * @param nshards the number of shards
+ */
+void join_shards(struct shard *shards, int nshards);
+
+#endif /* SHARD_H_ */
@@ -0,0 +1,471 @@
+/*
+ * simd_util.c
+ *
+ * String kernels for the request and response paths. SSE4.2
+ * and AVX2 versions are selected at startup if the cpu has
+ * them, with scalar versions for other cpus.
+ *
+ *  @since 2020-04-22
+ */
+#include <string.h>
+
+#include "simd_util.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+/**
+ * Find the first byte that is one of a set, one byte at a time.
+ *
+ * @param s the bytes to search
+ * @param len the number of bytes
+ * @param set the bytes to find
+ * @param nset the number of bytes in the set
+ * @return the offset of the byte, or len if none
+ */
+static size_t find_any_scalar(const char *s, size_t len, const char *set, size_t nset) {
+	size_t i = 0;
+	while ((i < len) && (memchr(set, s[i], nset) == NULL)) {
+		i++;
+	}
+	return i;
+}
+
+/**
+ * Get the length of the leading run of text bytes, one byte at a time.
+ *
+ * @param s the bytes to search
+ * @param len the number of bytes
+ * @param min the smallest text byte
+ * @return the length of the run
+ */
+static size_t span_text_scalar(const char *s, size_t len, unsigned char min) {
+	size_t i = 0;
+	while ((i < len) && ((unsigned char)s[i] >= min) && (s[i] != 0x7f)) {
+		i++;
+	}
+	return i;
+}
+
+/**
+ * Convert an ASCII upper-case byte to lower case.
+ *
+ * @param c the byte
+ * @return the lower-case byte
+ */
+static char lower_byte(char c) {
+	return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/**
+ * Compare bytes ignoring ASCII case, one byte at a time.
+ *
+ * @param a the first bytes
+ * @param b the second bytes
+ * @param len the number of bytes to compare
+ * @return true if the bytes are equal ignoring case
+ */
+static bool caseeq_scalar(const char *a, const char *b, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (lower_byte(a[i]) != lower_byte(b[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Convert bytes to lower case, one byte at a time.
+ *
+ * @param dst the destination bytes
+ * @param src the source bytes
+ * @param len the number of bytes
+ */
+static void lower_scalar(char *dst, const char *src, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		dst[i] = lower_byte(src[i]);
+	}
+}
+
+#ifdef SIMD_X86
+
+// SSE4.2 versions of the kernels process 16 bytes at a time,
+// and finish with the scalar versions
+
+/**
+ * Convert ASCII upper-case bytes of a vector to lower case.
+ * Bytes above 0x7f compare as negative, so they are unchanged.
+ *
+ * @param v the bytes
+ * @return the lower-case bytes
+ */
+__attribute__((target("sse4.2")))
+static inline __m128i lower_sse42_vec(__m128i v) {
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+								  _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+	return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+
+__attribute__((target("sse4.2")))
+static size_t find_any_sse42(const char *s, size_t len, const char *set, size_t nset) {
+	char setbuf[16] = { 0 };
+	memcpy(setbuf, set, nset);
+	const __m128i setv = _mm_loadu_si128((const __m128i *)setbuf);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		int index = _mm_cmpestri(setv, nset, v, 16,
+				_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+		if (index < 16) {
+			return i + index;
+		}
+	}
+	return i + find_any_scalar(s + i, len - i, set, nset);
+}
+
+__attribute__((target("sse4.2")))
+static size_t span_text_sse42(const char *s, size_t len, unsigned char min) {
+	const __m128i minv = _mm_set1_epi8(min);
+	const __m128i del = _mm_set1_epi8(0x7f);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i text = _mm_andnot_si128(_mm_cmpeq_epi8(v, del),
+										_mm_cmpeq_epi8(_mm_max_epu8(v, minv), v));
+		unsigned mask = _mm_movemask_epi8(text) ^ 0xffff;
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + span_text_scalar(s + i, len - i, min);
+}
+
+__attribute__((target("sse4.2")))
+static bool caseeq_sse42(const char *a, const char *b, size_t len) {
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i va = lower_sse42_vec(_mm_loadu_si128((const __m128i *)(a + i)));
+		__m128i vb = lower_sse42_vec(_mm_loadu_si128((const __m128i *)(b + i)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) {
+			return false;
+		}
+	}
+	return caseeq_scalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("sse4.2")))
+static void lower_sse42(char *dst, const char *src, size_t len) {
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), lower_sse42_vec(v));
+	}
+	lower_scalar(dst + i, src + i, len - i);
+}
+
+// AVX2 versions of the kernels process 32 bytes at a time,
+// and finish with the SSE4.2 versions
+
+/**
+ * Convert ASCII upper-case bytes of a vector to lower case.
+ * Bytes above 0x7f compare as negative, so they are unchanged.
+ *
+ * @param v the bytes
+ * @return the lower-case bytes
+ */
+__attribute__((target("avx2")))
+static inline __m256i lower_avx2_vec(__m256i v) {
+	__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+									 _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+	return _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+}
+
+__attribute__((target("avx2")))
+static size_t find_any_avx2(const char *s, size_t len, const char *set, size_t nset) {
+	__m256i setv[16];
+	for (size_t j = 0; j < nset; j++) {
+		setv[j] = _mm256_set1_epi8(set[j]);
+	}
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i found = _mm256_setzero_si256();
+		for (size_t j = 0; j < nset; j++) {
+			found = _mm256_or_si256(found, _mm256_cmpeq_epi8(v, setv[j]));
+		}
+		unsigned mask = _mm256_movemask_epi8(found);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	_mm256_zeroupper();  // avoid AVX to SSE transition penalties in the tail
+	return i + find_any_sse42(s + i, len - i, set, nset);
+}
+
+__attribute__((target("avx2")))
+static size_t span_text_avx2(const char *s, size_t len, unsigned char min) {
+	const __m256i minv = _mm256_set1_epi8(min);
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i text = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, del),
+										   _mm256_cmpeq_epi8(_mm256_max_epu8(v, minv), v));
+		unsigned mask = ~(unsigned)_mm256_movemask_epi8(text);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	_mm256_zeroupper();
+	return i + span_text_sse42(s + i, len - i, min);
+}
+
+__attribute__((target("avx2")))
+static bool caseeq_avx2(const char *a, const char *b, size_t len) {
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i va = lower_avx2_vec(_mm256_loadu_si256((const __m256i *)(a + i)));
+		__m256i vb = lower_avx2_vec(_mm256_loadu_si256((const __m256i *)(b + i)));
+		if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != 0xffffffffu) {
+			return false;
+		}
+	}
+	_mm256_zeroupper();
+	return caseeq_sse42(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void lower_avx2(char *dst, const char *src, size_t len) {
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), lower_avx2_vec(v));
+	}
+	_mm256_zeroupper();
+	lower_sse42(dst + i, src + i, len - i);
+}
+
+/**
+ * Determine whether the cpu has SSE4.2.
+ *
+ * @return true if the cpu has SSE4.2
+ */
+static bool cpu_has_sse42(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+
+/**
+ * Determine whether the cpu has AVX2.
+ *
+ * @return true if the cpu has AVX2
+ */
+static bool cpu_has_avx2(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif /* SIMD_X86 */
+
+/** kernels for one instruction set */
+struct str_kernels {
+	const char *isa;
+	bool (*supported)(void);
+	size_t (*find_any)(const char *s, size_t len, const char *set, size_t nset);
+	size_t (*span_text)(const char *s, size_t len, unsigned char min);
+	bool (*caseeq)(const char *a, const char *b, size_t len);
+	void (*lower)(char *dst, const char *src, size_t len);
+};
+
+/** kernels for each instruction set, best last */
+static const struct str_kernels all_kernels[] = {
+	{ "scalar", NULL, find_any_scalar, span_text_scalar, caseeq_scalar, lower_scalar },
+#ifdef SIMD_X86
+	{ "sse4.2", cpu_has_sse42, find_any_sse42, span_text_sse42, caseeq_sse42, lower_sse42 },
+	{ "avx2", cpu_has_avx2, find_any_avx2, span_text_avx2, caseeq_avx2, lower_avx2 },
+#endif
+};
+
+/** kernels for the instruction set of the cpu */
+static struct str_kernels kernels = {
+	"scalar", NULL, find_any_scalar, span_text_scalar, caseeq_scalar, lower_scalar
+};
+
+/**
+ * Select the kernels for an instruction set if the cpu has it.
+ * The kernels must not be in use by other threads.
+ *
+ * @param isa "avx2", "sse4.2" or "scalar"
+ * @return true if the kernels were selected
+ */
+bool str_kernels_select(const char *isa) {
+	for (size_t i = 0; i < sizeof(all_kernels) / sizeof(all_kernels[0]); i++) {
+		if (strcmp(all_kernels[i].isa, isa) != 0) {
+			continue;
+		}
+		if ((all_kernels[i].supported != NULL) && !all_kernels[i].supported()) {
+			return false;
+		}
+		kernels = all_kernels[i];
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Select the best kernels for the cpu before main() runs,
+ * so they do not change while threads are using them.
+ */
+__attribute__((constructor))
+static void str_kernels_init(void) {
+	for (size_t i = sizeof(all_kernels) / sizeof(all_kernels[0]); i > 1; i--) {
+		if (str_kernels_select(all_kernels[i - 1].isa)) {
+			break;
+		}
+	}
+}
+
+/**
+ * Get the name of the instruction set used by the kernels.
+ *
+ * @return "avx2", "sse4.2" or "scalar"
+ */
+const char *str_kernels_isa(void) {
+	return kernels.isa;
+}
+
+/**
+ * Find the first byte that is one of a set of bytes.
+ *
+ * @param s the bytes to search
+ * @param len the number of bytes
+ * @param set the bytes to find; at most 16
+ * @return the offset of the byte, or len if none
+ */
+size_t str_find_any(const char *s, size_t len, const char *set) {
+	return kernels.find_any(s, len, set, strnlen(set, 16));
+}
+
+/**
+ * Get the length of the leading run of text bytes: those that
+ * are at least a minimum value, other than DEL. Bytes above
+ * 0x7f are text.
+ *
+ * @param s the bytes to search
+ * @param len the number of bytes
+ * @param min the smallest text byte, such as ' ' or '!'
+ * @return the length of the run
+ */
+size_t str_span_text(const char *s, size_t len, unsigned char min) {
+	return kernels.span_text(s, len, min);
+}
+
+/**
+ * Compare bytes ignoring ASCII case.
+ *
+ * @param a the first bytes
+ * @param b the second bytes
+ * @param len the number of bytes to compare
+ * @return true if the bytes are equal ignoring case
+ */
+bool str_caseeq(const char *a, const char *b, size_t len) {
+	return kernels.caseeq(a, b, len);
+}
+
+/**
+ * Convert ASCII upper-case bytes to lower case. The source and
+ * destination can be the same.
+ *
+ * @param dst the destination bytes
+ * @param src the source bytes
+ * @param len the number of bytes
+ */
+void str_lower(char *dst, const char *src, size_t len) {
+	kernels.lower(dst, src, len);
+}
+
+/**
+ * Get the value of a hexadecimal digit.
+ *
+ * @param c the digit
+ * @return the value, or -1 if not a digit
+ */
+static int hex_value(unsigned char c) {
+	if ((c >= '0') && (c <= '9')) {
+		return c - '0';
+	}
+	c |= 'a' - 'A';
+	return ((c >= 'a') && (c <= 'f')) ? c - 'a' + 10 : -1;
+}
+
+/**
+ * Decode %xx escapes. The source and destination can be the same.
+ *
+ * @param dst the destination, with room for len bytes
+ * @param src the escaped bytes
+ * @param len the number of escaped bytes
+ * @return the number of decoded bytes, or -1 if an escape is malformed
+ *   or decodes to a NUL byte
+ */
+ssize_t str_percent_decode(char *dst, const char *src, size_t len) {
+	size_t ndst = 0;
+	size_t i = 0;
+	while (i < len) {
+		// copy the run up to the next escape
+		size_t run = kernels.find_any(src + i, len - i, "%", 1);
+		memmove(dst + ndst, src + i, run);
+		ndst += run;
+		i += run;
+		if (i == len) {
+			break;
+		}
+		int hi = (i + 1 < len) ? hex_value(src[i + 1]) : -1;
+		int lo = (i + 2 < len) ? hex_value(src[i + 2]) : -1;
+		// %00 would cut the decoded string short
+		if ((hi < 0) || (lo < 0) || ((hi | lo) == 0)) {
+			return -1;
+		}
+		dst[ndst++] = (char)((hi << 4) | lo);
+		i += 3;
+	}
+	return ndst;
+}
+
+/**
+ * Escape the HTML special characters &, <, >, " and '
+ * as character references, and terminate the result.
+ *
+ * @param dst the destination, with room for 6 * len + 1 bytes
+ * @param src the bytes to escape
+ * @param len the number of bytes
+ * @return the number of escaped bytes, not including the terminator
+ */
+size_t str_html_escape(char *dst, const char *src, size_t len) {
+	size_t ndst = 0;
+	size_t i = 0;
+	while (i < len) {
+		// copy the run up to the next special character
+		size_t run = kernels.find_any(src + i, len - i, "&<>\"'", 5);
+		memcpy(dst + ndst, src + i, run);
+		ndst += run;
+		i += run;
+		if (i == len) {
+			break;
+		}
+		const char *ref;
+		switch (src[i++]) {
+		case '&':  ref = "&amp;"; break;
+		case '<':  ref = "&lt;"; break;
+		case '>':  ref = "&gt;"; break;
+		case '"':  ref = "&quot;"; break;
+		default:   ref = "&#39;"; break;
+		}
+		size_t nref = strlen(ref);
+		memcpy(dst + ndst, ref, nref);
+		ndst += nref;
+	}
+	dst[ndst] = '\0';
+	return ndst;
+}
@@ -0,0 +1,99 @@
+/*
+ * simd_util.h
+ *
+ * String kernels for the request and response paths. SSE4.2
+ * and AVX2 versions are selected at startup if the cpu has
+ * them, with scalar versions for other cpus.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef SIMD_UTIL_H_
+#define SIMD_UTIL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Get the name of the instruction set used by the kernels.
+ *
+ * @return "avx2", "sse4.2" or "scalar"
+ */
+const char *str_kernels_isa(void);
+
+/**
+ * Select the kernels for an instruction set if the cpu has it,
+ * such as to test them. The kernels must not be in use by other
+ * threads.
+ *
+ * @param isa "avx2", "sse4.2" or "scalar"
+ * @return true if the kernels were selected
+ */
+bool str_kernels_select(const char *isa);
+
+/**
+ * Find the first byte that is one of a set of bytes.
+ *
+ * @param s the bytes to search
+ * @param len the number of bytes
+ * @param set the bytes to find; at most 16
+ * @return the offset of the byte, or len if none
+ */
+size_t str_find_any(const char *s, size_t len, const char *set);
+
+/**
+ * Get the length of the leading run of text bytes: those that
+ * are at least a minimum value, other than DEL. Bytes above
+ * 0x7f are text.
+ *
+ * @param s the bytes to search
+ * @param len the number of bytes
+ * @param min the smallest text byte, such as ' ' or '!'
+ * @return the length of the run
+ */
+size_t str_span_text(const char *s, size_t len, unsigned char min);
+
+/**
+ * Compare bytes ignoring ASCII case.
+ *
+ * @param a the first bytes
+ * @param b the second bytes
+ * @param len the number of bytes to compare
+ * @return true if the bytes are equal ignoring case
+ */
+bool str_caseeq(const char *a, const char *b, size_t len);
+
+/**
+ * Convert ASCII upper-case bytes to lower case. The source and
+ * destination can be the same.
+ *
+ * @param dst the destination bytes
+ * @param src the source bytes
+ * @param len the number of bytes
+ */
+void str_lower(char *dst, const char *src, size_t len);
+
+/**
+ * Decode %xx escapes. The source and destination can be the same.
+ *
+ * @param dst the destination, with room for len bytes
+ * @param src the escaped bytes
+ * @param len the number of escaped bytes
+ * @return the number of decoded bytes, or -1 if an escape is malformed
+ *   or decodes to a NUL byte
+ */
+ssize_t str_percent_decode(char *dst, const char *src, size_t len);
+
+/**
+ * Escape the HTML special characters &, <, >, " and '
+ * as character references, and terminate the result.
+ *
+ * @param dst the destination, with room for 6 * len + 1 bytes
+ * @param src the bytes to escape
+ * @param len the number of bytes
+ * @return the number of escaped bytes, not including the terminator
+ */
+size_t str_html_escape(char *dst, const char *src, size_t len);
+
+#endif /* SIMD_UTIL_H_ */
@@ -8,8 +8,8 @@
  */
 
 #include <stdbool.h>
-#include <ctype.h>
 #include <string.h>
+#include "simd_util.h"
 #include "string_util.h"
 
 /**
@@ -22,12 +22,10 @@
  */
 char *strlower(char *dest, const char *src)
 {
-	int i;
-    for (i = 0; src[i] != '\0'; i++) {
-        dest[i] = tolower(src[i]);
-    }
-    dest[i] = '\0';
-    return dest;
+	size_t len = strlen(src);
+	str_lower(dest, src, len);
+	dest[len] = '\0';
+	return dest;
 }
 
 /**
@@ -40,7 +38,7 @@ char *strlower(char *dest, const char *src)
 bool strendswith(const char *src, const char *endswith) {
 	size_t srclen = strlen(src);
 	size_t endslen = strlen(endswith);
-	return (srclen >= endslen) && (strcmp(src+srclen-endslen, endswith) == 0);
+	return (srclen >= endslen) && (memcmp(src+srclen-endslen, endswith, endslen) == 0);
 }
 
 /**
@@ -63,3 +61,37 @@ bool trim_newline(char *src) {
 	}
 	return false;
 }
+
+/** decimal digit pairs "00" through "99" */
+static const char digitPairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/**
+ * Write the decimal digits of an unsigned value to the
+ * destination string, two digits at a time.
+ *
+ * @param dest destination string with room for 21 bytes
+ * @param val the value
+ * @return the number of digits written before the terminating null
+ */
+size_t utostr(char *dest, uint64_t val) {
+	char buf[20];
+	char *p = buf + sizeof(buf);
+	while (val >= 100) {
+		p -= 2;
+		memcpy(p, digitPairs + 2 * (val % 100), 2);
+		val /= 100;
+	}
+	if (val >= 10) {
+		p -= 2;
+		memcpy(p, digitPairs + 2 * val, 2);
+	} else {
+		*--p = '0' + val;
+	}
+	size_t len = buf + sizeof(buf) - p;
+	memcpy(dest, p, len);
+	dest[len] = '\0';
+	return len;
+}
@@ -11,6 +11,8 @@
 #define STRING_UTIL_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
  * Write the lower-case version of the source
@@ -39,4 +41,14 @@ bool strendswith(const char *src, const char *endswith);
  */
 bool trim_newline(char *src);
 
+/**
+ * Write the decimal digits of an unsigned value to the
+ * destination string, two digits at a time.
+ *
+ * @param dest destination string with room for 21 bytes
+ * @param val the value
+ * @return the number of digits written before the terminating null
+ */
+size_t utostr(char *dest, uint64_t val);
+
 #endif /* STRING_UTIL_H_ */
@@ -7,31 +7,158 @@
  *  @author: Philip Gust
  */
 
+#include <stdbool.h>
+#include <string.h>
 #include "time_util.h"
 
+/** number of current date strings kept, indexed by second */
+#define DATE_RING_SIZE 4
+
+/** time of a date slot that a thread is formatting */
+#define DATE_BUSY ((time_t)-1)
+
+/** number of file time strings cached by each thread; a power of 2 */
+#define FILE_TIME_CACHE_SIZE 64
+
+/** words of a date string, read and written atomically */
+#define DATE_WORDS (RFC_1123_DATE_SIZE / sizeof(uint64_t))
+
+/** a current date string and the second it holds */
+struct date_slot {
+	time_t time;
+	uint64_t words[DATE_WORDS];
+};
+
+/** recent current date strings; the slot of a second is second % DATE_RING_SIZE */
+static struct date_slot dateRing[DATE_RING_SIZE];
+
+/** a file time and its date string */
+struct file_time {
+	time_t time;
+	char str[RFC_1123_DATE_SIZE];
+};
+
+/** file time strings cached by the calling thread, by time */
+static __thread struct file_time fileTimes[FILE_TIME_CACHE_SIZE];
+
 /**
  * Converts timer to a RFC-1123 formatted date-time string
  * of the form: Sat, 13 Apr 2019 19:03:32 GMT
  * @param timer the time
- * @param buf the buffer
+ * @param buf the buffer of RFC_1123_DATE_SIZE bytes
  * @return pointer to the buffer
  */
 char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf) {
-	struct tm* tm_info = gmtime(&timer);
-	strftime(buf, 128, "%a, %d %b %Y %H:%M:%S GMT", tm_info);
+	struct tm tm_info;
+	gmtime_r(&timer, &tm_info);
+	if (strftime(buf, RFC_1123_DATE_SIZE, "%a, %d %b %Y %H:%M:%S GMT", &tm_info) == 0) {
+		buf[0] = '\0';  // year too large to format
+	}
 	return buf;
 }
 
+/**
+ * Copies the date string of a second from its slot, if the slot
+ * holds that second for the whole copy.
+ * @param slot the slot
+ * @param now the second
+ * @param buf the buffer of RFC_1123_DATE_SIZE bytes
+ * @return true if the string was copied
+ */
+static bool readDateSlot(struct date_slot *slot, time_t now, char *buf) {
+	if (__atomic_load_n(&slot->time, __ATOMIC_ACQUIRE) != now) {
+		return false;
+	}
+	uint64_t words[DATE_WORDS];
+	for (size_t i = 0; i < DATE_WORDS; i++) {
+		words[i] = __atomic_load_n(&slot->words[i], __ATOMIC_RELAXED);
+	}
+	// the slot was not claimed for another second during the copy
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->time, __ATOMIC_RELAXED) != now) {
+		return false;
+	}
+	memcpy(buf, words, RFC_1123_DATE_SIZE);
+	return true;
+}
+
+/**
+ * Returns the current time as a RFC-1123 formatted date-time
+ * string. The string is formatted once per second by the first
+ * thread to claim the slot for that second, and other threads
+ * copy it from there. A thread that finds the slot busy or
+ * holding another second formats the string itself.
+ * @return the date-time string, valid until the thread asks again
+ */
+const char *currentRFC_1123_Date_Time(void) {
+	static __thread time_t bufTime = -1;
+	static __thread char buf[RFC_1123_DATE_SIZE];
+	time_t now = time(NULL);
+	if (now == bufTime) {
+		return buf;
+	}
+
+	struct date_slot *slot = &dateRing[(uint64_t)now % DATE_RING_SIZE];
+	if (!readDateSlot(slot, now, buf)) {
+		milliTimeToRFC_1123_Date_Time(now, buf);
+		// publish only into a slot that holds an older second, so slots never go back
+		time_t old = __atomic_load_n(&slot->time, __ATOMIC_RELAXED);
+		if ((old != DATE_BUSY) && (old < now)
+			&& __atomic_compare_exchange_n(&slot->time, &old, DATE_BUSY, false,
+										   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			// a reader that sees any new word also sees the slot busy
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			uint64_t words[DATE_WORDS];
+			memcpy(words, buf, RFC_1123_DATE_SIZE);
+			for (size_t i = 0; i < DATE_WORDS; i++) {
+				__atomic_store_n(&slot->words[i], words[i], __ATOMIC_RELAXED);
+			}
+			__atomic_store_n(&slot->time, now, __ATOMIC_RELEASE);
+		}
+	}
+	bufTime = now;
+	return buf;
+}
+
+/**
+ * Returns a file time as a RFC-1123 formatted date-time string,
+ * cached by the calling thread since files often share times.
+ * @param timer the time
+ * @return the date-time string, valid until the thread asks again
+ */
+const char *fileTimeToRFC_1123_Date_Time(time_t timer) {
+	struct file_time *entry = &fileTimes[(uint64_t)timer % FILE_TIME_CACHE_SIZE];
+	if ((entry->time != timer) || (entry->str[0] == '\0')) {
+		entry->time = timer;
+		milliTimeToRFC_1123_Date_Time(timer, entry->str);
+	}
+	return entry->str;
+}
+
 /**
  * Converts timer to short formatted date-time string
  * of the form: 2015-11-18 08:43
  * of the form
  * @param timer the time
- * @param buf the buffer
+ * @param buf the buffer of RFC_1123_DATE_SIZE bytes
  * @return pointer to the buffer
  */
 char *milliTimeToShortHM_Date_Time(time_t timer, char *buf) {
-	struct tm* tm_info = gmtime(&timer);
-	strftime(buf, 128, "%F %H:%M", tm_info);
+	struct tm tm_info;
+	gmtime_r(&timer, &tm_info);
+	if (strftime(buf, RFC_1123_DATE_SIZE, "%F %H:%M", &tm_info) == 0) {
+		buf[0] = '\0';  // year too large to format
+	}
 	return buf;
 }
+
+/**
+ * Returns the current monotonic time, which is unaffected
+ * by changes to the system clock.
+ * @return the time in nanoseconds
+ */
+uint64_t monotonicTimeNanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -10,24 +10,53 @@
 #ifndef TIME_UTIL_H_
 #define TIME_UTIL_H_
 
+#include <stdint.h>
 #include <time.h>
 
+/** size of a buffer for a formatted date-time string */
+#define RFC_1123_DATE_SIZE 32
+
 /**
  * Converts timer to a RFC-1123 formatted date-time string.
  * @param timer the time
- * @param buf the buffer
+ * @param buf the buffer of RFC_1123_DATE_SIZE bytes
  * @return pointer to the buffer
  */
 char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf);
 
+/**
+ * Returns the current time as a RFC-1123 formatted date-time
+ * string. The string is formatted once per second by the first
+ * thread to claim the slot for that second, and other threads
+ * copy it from there. A thread that finds the slot busy or
+ * holding another second formats the string itself.
+ * @return the date-time string, valid until the thread asks again
+ */
+const char *currentRFC_1123_Date_Time(void);
+
+/**
+ * Returns a file time as a RFC-1123 formatted date-time string,
+ * cached by the calling thread since files often share times.
+ * @param timer the time
+ * @return the date-time string, valid until the thread asks again
+ */
+const char *fileTimeToRFC_1123_Date_Time(time_t timer);
+
 /**
  * Converts timer to short formatted date-time string
  * of the form: 2015-11-18 08:43
  * of the form
  * @param timer the time
- * @param buf the buffer
+ * @param buf the buffer of RFC_1123_DATE_SIZE bytes
  * @return pointer to the buffer
  */
 char *milliTimeToShortHM_Date_Time(time_t timer, char *buf);
 
+/**
+ * Returns the current monotonic time, which is unaffected
+ * by changes to the system clock.
+ * @return the time in nanoseconds
+ */
+uint64_t monotonicTimeNanos(void);
+
 #endif /* TIME_UTIL_H_ */
@@ -0,0 +1,119 @@
+/*
+ * timer_wheel.c
+ *
+ * Hashed timing wheel for connection deadlines. Timers hash to
+ * a slot by their expiry tick, so scheduling and cancelling are
+ * O(1); timers more than one revolution away stay in their slot
+ * until their tick comes around.
+ *
+ *  @since 2020-04-22
+ */
+#include <stddef.h>
+
+#include "timer_wheel.h"
+
+/**
+ * Initialize a timing wheel.
+ *
+ * @param wheel the timing wheel
+ * @param now_ms the current monotonic time in milliseconds
+ */
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_ms) {
+	for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+		wheel->slots[i].prev = wheel->slots[i].next = &wheel->slots[i];
+	}
+	wheel->tick = now_ms / TIMER_TICK_MS;
+}
+
+/**
+ * Initialize a timer that is not scheduled.
+ *
+ * @param timer the timer
+ * @param data the object passed to the expiry function
+ */
+void timer_init(struct timer *timer, void *data) {
+	timer->prev = timer->next = NULL;
+	timer->expires = 0;
+	timer->data = data;
+}
+
+/**
+ * Determine whether a timer is scheduled.
+ *
+ * @param timer the timer
+ * @return true if the timer is scheduled
+ */
+bool timer_pending(const struct timer *timer) {
+	return timer->next != NULL;
+}
+
+/**
+ * Schedule a timer, replacing its previous deadline if any.
+ * A timer does not expire before its deadline, but may expire
+ * up to one tick after it.
+ *
+ * @param wheel the timing wheel
+ * @param timer the timer
+ * @param deadline_ms the monotonic deadline in milliseconds
+ */
+void timer_schedule(struct timer_wheel *wheel, struct timer *timer, uint64_t deadline_ms) {
+	timer_cancel(timer);
+
+	// round up so the timer never expires early
+	timer->expires = (deadline_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	if (timer->expires < wheel->tick) {
+		timer->expires = wheel->tick;
+	}
+
+	struct timer *head = &wheel->slots[timer->expires & (TIMER_WHEEL_SLOTS - 1)];
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+/**
+ * Cancel a timer if it is scheduled.
+ *
+ * @param timer the timer
+ */
+void timer_cancel(struct timer *timer) {
+	if (timer->next != NULL) {
+		timer->prev->next = timer->next;
+		timer->next->prev = timer->prev;
+		timer->prev = timer->next = NULL;
+	}
+}
+
+/**
+ * Advance the wheel to the current time, cancelling expired
+ * timers and calling the expiry function for each. The expiry
+ * function must not schedule or cancel timers.
+ *
+ * @param wheel the timing wheel
+ * @param now_ms the current monotonic time in milliseconds
+ * @param expired the expiry function, called with the timer data
+ * @param arg the second argument to the expiry function
+ */
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms,
+		void (*expired)(void *data, void *arg), void *arg) {
+	uint64_t now = now_ms / TIMER_TICK_MS;
+
+	// after a long pause, one revolution visits every slot
+	if (now >= wheel->tick + TIMER_WHEEL_SLOTS) {
+		wheel->tick = now - TIMER_WHEEL_SLOTS + 1;
+	}
+
+	for (; wheel->tick <= now; wheel->tick++) {
+		struct timer *head = &wheel->slots[wheel->tick & (TIMER_WHEEL_SLOTS - 1)];
+		struct timer *timer = head->next;
+		while (timer != head) {
+			struct timer *next = timer->next;
+			if (timer->expires <= now) {  // otherwise due in a later revolution
+				timer_cancel(timer);
+				expired(timer->data, arg);
+			}
+			timer = next;
+		}
+	}
+}
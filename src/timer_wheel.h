@@ -0,0 +1,100 @@
+/*
+ * timer_wheel.h
+ *
+ * Hashed timing wheel for connection deadlines. Timers hash to
+ * a slot by their expiry tick, so scheduling and cancelling are
+ * O(1); timers more than one revolution away stay in their slot
+ * until their tick comes around.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** length of a tick in milliseconds */
+#define TIMER_TICK_MS 100
+
+/** number of slots in the wheel; a power of 2 */
+#define TIMER_WHEEL_SLOTS 1024
+
+/** a timer, embedded in the object it times */
+struct timer {
+	/** links in the slot list, or NULL if not scheduled */
+	struct timer *prev, *next;
+
+	/** tick when the timer expires */
+	uint64_t expires;
+
+	/** object passed to the expiry function */
+	void *data;
+};
+
+/** a timing wheel */
+struct timer_wheel {
+	/** list heads of the slots */
+	struct timer slots[TIMER_WHEEL_SLOTS];
+
+	/** next tick to be processed */
+	uint64_t tick;
+};
+
+/**
+ * Initialize a timing wheel.
+ *
+ * @param wheel the timing wheel
+ * @param now_ms the current monotonic time in milliseconds
+ */
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_ms);
+
+/**
+ * Initialize a timer that is not scheduled.
+ *
+ * @param timer the timer
+ * @param data the object passed to the expiry function
+ */
+void timer_init(struct timer *timer, void *data);
+
+/**
+ * Determine whether a timer is scheduled.
+ *
+ * @param timer the timer
+ * @return true if the timer is scheduled
+ */
+bool timer_pending(const struct timer *timer);
+
+/**
+ * Schedule a timer, replacing its previous deadline if any.
+ * A timer does not expire before its deadline, but may expire
+ * up to one tick after it.
+ *
+ * @param wheel the timing wheel
+ * @param timer the timer
+ * @param deadline_ms the monotonic deadline in milliseconds
+ */
+void timer_schedule(struct timer_wheel *wheel, struct timer *timer, uint64_t deadline_ms);
+
+/**
+ * Cancel a timer if it is scheduled.
+ *
+ * @param timer the timer
+ */
+void timer_cancel(struct timer *timer);
+
+/**
+ * Advance the wheel to the current time, cancelling expired
+ * timers and calling the expiry function for each. The expiry
+ * function must not schedule or cancel timers.
+ *
+ * @param wheel the timing wheel
+ * @param now_ms the current monotonic time in milliseconds
+ * @param expired the expiry function, called with the timer data
+ * @param arg the second argument to the expiry function
+ */
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms,
+		void (*expired)(void *data, void *arg), void *arg);
+
+#endif /* TIMER_WHEEL_H_ */
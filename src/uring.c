@@ -0,0 +1,475 @@
+/*
+ * uring.c
+ *
+ * Minimal io_uring submission and completion ring used by the
+ * optional io_uring I/O backend. Uses the kernel interface
+ * directly so the server does not depend on liburing.
+ *
+ *  @since 2020-04-22
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "uring.h"
+
+/** number of entries in a per-thread file ring */
+#define FILE_RING_ENTRIES 16
+
+/** true if the kernel supports multishot accept */
+static bool multishot_accept;
+
+/** true if the kernel supports statx and openat on a ring */
+static bool file_ops;
+
+/** ring used by the current thread for file operations */
+static __thread struct uring file_ring;
+
+/** state of the current thread's file ring */
+static __thread enum { RING_NONE, RING_READY, RING_FAILED } file_ring_state;
+
+/**
+ * Set up a ring with the io_uring_setup system call.
+ */
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+/**
+ * Submit and wait with the io_uring_enter system call.
+ */
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * Register resources or probe a ring with the io_uring_register system call.
+ */
+static int sys_io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+	return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+/**
+ * Initialize an io_uring instance.
+ *
+ * @param ring the ring
+ * @param entries the number of submission queue entries
+ * @return 0 if successful, -1 with errno set if error
+ */
+int uring_init(struct uring *ring, unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(*ring));
+
+	ring->ring_fd = sys_io_uring_setup(entries, &params);
+	if (ring->ring_fd < 0) {
+		return -1;
+	}
+
+	// map submission and completion rings; newer kernels share one mapping
+	ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap && ring->cq_len > ring->sq_len) {
+		ring->sq_len = ring->cq_len;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		close(ring->ring_fd);
+		return -1;
+	}
+	if (single_mmap) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			munmap(ring->sq_ptr, ring->sq_len);
+			close(ring->ring_fd);
+			return -1;
+		}
+	}
+
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (!single_mmap) {
+			munmap(ring->cq_ptr, ring->cq_len);
+		}
+		munmap(ring->sq_ptr, ring->sq_len);
+		close(ring->ring_fd);
+		return -1;
+	}
+
+	char *sq = ring->sq_ptr;
+	ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->sqe_tail = *ring->sq_tail;
+
+	char *cq = ring->cq_ptr;
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+/**
+ * Release an io_uring instance.
+ *
+ * @param ring the ring
+ */
+void uring_exit(struct uring *ring) {
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_len);
+	}
+	munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->ring_fd);
+}
+
+/**
+ * Get the next free submission queue entry.
+ *
+ * @param ring the ring
+ * @return a zeroed entry or NULL if submission queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sqe_tail - head >= ring->sq_entries) {
+		return NULL;
+	}
+	unsigned index = ring->sqe_tail & *ring->sq_mask;
+	ring->sq_array[index] = index;
+	ring->sqe_tail++;
+
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/**
+ * Submit prepared entries, and optionally wait for completions.
+ *
+ * @param ring the ring
+ * @param wait_nr number of completions to wait for
+ * @return number of entries submitted, -1 with errno set if error
+ */
+int uring_submit(struct uring *ring, unsigned wait_nr) {
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+	// entries not yet consumed by the kernel include any left by EINTR
+	unsigned flags = (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0;
+	int nsubmitted;
+	do {
+		unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		nsubmitted = sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr, flags);
+	} while (nsubmitted < 0 && errno == EINTR);
+	return nsubmitted;
+}
+
+/**
+ * Get the next completion queue entry without waiting.
+ *
+ * @param ring the ring
+ * @return the entry or NULL if none are available
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+	unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+/**
+ * Mark the entry returned by uring_peek_cqe() as consumed.
+ *
+ * @param ring the ring
+ */
+void uring_cqe_seen(struct uring *ring) {
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Determine whether a ring supports all of a set of operations.
+ *
+ * @param ring the ring
+ * @param ops the operations
+ * @param nops the number of operations
+ * @return true if every operation is supported
+ */
+static bool probe_ops(struct uring *ring, const unsigned char *ops, size_t nops) {
+	struct {
+		struct io_uring_probe probe;
+		struct io_uring_probe_op ops[256];
+	} probe;
+	memset(&probe, 0, sizeof(probe));
+	if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PROBE, &probe, 256) != 0) {
+		return false;  // kernels before 5.6 cannot probe, and lack operations used
+	}
+	for (size_t i = 0; i < nops; i++) {
+		if (ops[i] > probe.probe.last_op
+				|| (probe.ops[ops[i]].flags & IO_URING_OP_SUPPORTED) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Determine whether a ring supports multishot accept (Linux 5.19),
+ * by accepting a connection to a UNIX domain listener. Older
+ * kernels that support accept fail the request with EINVAL.
+ *
+ * @param ring the ring
+ * @return true if multishot accept is supported
+ */
+static bool probe_multishot_accept(struct uring *ring) {
+	// autobind gives the listener an unused abstract address
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	socklen_t addrlen = sizeof(sa_family_t);
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int client_fd = -1;
+	bool supported = false;
+	if (listen_fd >= 0 && bind(listen_fd, (struct sockaddr *)&addr, addrlen) == 0
+			&& listen(listen_fd, 1) == 0
+			&& (addrlen = sizeof(addr), getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen) == 0)
+			&& (client_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0
+			&& connect(client_fd, (struct sockaddr *)&addr, addrlen) == 0) {
+		struct io_uring_sqe *sqe = uring_get_sqe(ring);
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = listen_fd;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		struct io_uring_cqe *cqe;
+		if (uring_submit(ring, 1) == 1 && (cqe = uring_peek_cqe(ring)) != NULL) {
+			supported = (cqe->res >= 0);
+			if (supported) {
+				close(cqe->res);
+			}
+			uring_cqe_seen(ring);
+		}
+	}
+	if (client_fd >= 0) {
+		close(client_fd);
+	}
+	if (listen_fd >= 0) {
+		close(listen_fd);
+	}
+	return supported;
+}
+
+/**
+ * Determine whether the io_uring backend is usable on this system:
+ * rings can be created, and support the operations of the event
+ * loop. Also records whether multishot accept and the file
+ * operations are supported. Call before starting other threads.
+ *
+ * @return true if the io_uring backend is usable
+ */
+bool uring_available(void) {
+	static const unsigned char loop_ops[] = {
+		IORING_OP_ACCEPT, IORING_OP_READ, IORING_OP_TIMEOUT, IORING_OP_RECV,
+		IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL
+	};
+	static const unsigned char file_ring_ops[] = { IORING_OP_STATX, IORING_OP_OPENAT };
+
+	struct uring ring;
+	if (uring_init(&ring, 4) != 0) {
+		return false;
+	}
+	bool available = probe_ops(&ring, loop_ops, sizeof(loop_ops));
+	file_ops = available && probe_ops(&ring, file_ring_ops, sizeof(file_ring_ops));
+	multishot_accept = available && probe_multishot_accept(&ring);
+	uring_exit(&ring);
+	return available;
+}
+
+/**
+ * Determine whether the kernel supports multishot accept, as
+ * found by uring_available().
+ *
+ * @return true if multishot accept is supported
+ */
+bool uring_multishot_accept(void) {
+	return multishot_accept;
+}
+
+/**
+ * Get the calling thread's file ring, creating it on first use.
+ *
+ * @return the ring or NULL with errno set if unavailable
+ */
+static struct uring *get_file_ring(void) {
+	if (!file_ops) {
+		errno = ENOSYS;
+		return NULL;
+	}
+	if (file_ring_state == RING_NONE) {
+		if (uring_init(&file_ring, FILE_RING_ENTRIES) == 0) {
+			file_ring_state = RING_READY;
+		} else {
+			// retry later if out of descriptors or memory
+			int err = errno;
+			if (err != EMFILE && err != ENFILE && err != ENOMEM) {
+				file_ring_state = RING_FAILED;
+			}
+			errno = err;
+			return NULL;
+		}
+	}
+	if (file_ring_state != RING_READY) {
+		errno = ENOSYS;
+		return NULL;
+	}
+	return &file_ring;
+}
+
+/**
+ * Wait for the specified number of completions, recording the
+ * result of each by its user data index.
+ *
+ * @param ring the ring
+ * @param ncomplete the number of completions
+ * @param results the results by index
+ * @return 0 if successful, -1 with errno set if error
+ */
+static int reap_completions(struct uring *ring, unsigned ncomplete, int results[]) {
+	if (uring_submit(ring, ncomplete) < 0) {
+		return -1;
+	}
+	for (unsigned n = 0; n < ncomplete; ) {
+		struct io_uring_cqe *cqe = uring_peek_cqe(ring);
+		if (cqe == NULL) {
+			if (uring_submit(ring, 1) < 0) {
+				return -1;
+			}
+			continue;
+		}
+		results[cqe->user_data] = cqe->res;
+		uring_cqe_seen(ring);
+		n++;
+	}
+	return 0;
+}
+
+/**
+ * Prepare a statx of a file.
+ *
+ * @param ring the ring
+ * @param path the file path
+ * @param stx the statx struct to fill in
+ * @param user_data the user data of the entry
+ * @return the entry
+ */
+static struct io_uring_sqe *prep_statx(struct uring *ring, const char *path, struct statx *stx,
+									   uint64_t user_data) {
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)path;
+	sqe->len = STATX_BASIC_STATS;
+	sqe->off = (uintptr_t)stx;
+	sqe->user_data = user_data;
+	return sqe;
+}
+
+/**
+ * Copy the fields of a statx struct used by the server to a stat struct.
+ *
+ * @param stx the statx struct
+ * @param sb the stat struct
+ */
+static void statx_to_stat(const struct statx *stx, struct stat *sb) {
+	memset(sb, 0, sizeof(*sb));
+	sb->st_mode = stx->stx_mode;
+	sb->st_size = stx->stx_size;
+	sb->st_ino = stx->stx_ino;
+	sb->st_nlink = stx->stx_nlink;
+	sb->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	sb->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	sb->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	sb->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	sb->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	sb->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/**
+ * Get the status of a file using the calling thread's ring.
+ *
+ * @param path the file path
+ * @param sb the stat struct (mode, size, and times are set)
+ * @return 0 if successful, or -1 with errno set if error
+ */
+int uring_stat(const char *path, struct stat *sb) {
+	struct uring *ring = get_file_ring();
+	if (ring == NULL) {
+		return -1;
+	}
+
+	struct statx stx;
+	prep_statx(ring, path, &stx, 0);
+	int result;
+	if (reap_completions(ring, 1, &result) != 0) {
+		return -1;
+	}
+	if (result < 0) {
+		errno = -result;
+		return -1;
+	}
+	statx_to_stat(&stx, sb);
+	return 0;
+}
+
+/**
+ * Get the status of a file and open it for reading, using
+ * a single submission on the calling thread's ring.
+ *
+ * @param path the file path
+ * @param sb the stat struct (mode, size, and times are set)
+ * @return the open file descriptor, or -1 with errno set if error
+ */
+int uring_open_stat(const char *path, struct stat *sb) {
+	struct uring *ring = get_file_ring();
+	if (ring == NULL) {
+		return -1;
+	}
+
+	// statx is linked to openat so a missing file cancels the open
+	struct statx stx;
+	prep_statx(ring, path, &stx, 0)->flags = IOSQE_IO_LINK;
+
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)path;
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+	sqe->user_data = 1;
+
+	int results[2];
+	if (reap_completions(ring, 2, results) != 0) {
+		return -1;
+	}
+	if (results[0] < 0 || results[1] < 0) {
+		if (results[1] >= 0) {
+			close(results[1]);
+		}
+		errno = (results[0] < 0) ? -results[0] : -results[1];
+		return -1;
+	}
+	statx_to_stat(&stx, sb);
+	return results[1];
+}
@@ -0,0 +1,138 @@
+/*
+ * uring.h
+ *
+ * Minimal io_uring submission and completion ring used by the
+ * optional io_uring I/O backend. Uses the kernel interface
+ * directly so the server does not depend on liburing.
+ *
+ *  @since 2020-04-22
+ */
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <linux/io_uring.h>
+
+/** an io_uring instance */
+struct uring {
+	/** the ring descriptor */
+	int ring_fd;
+
+	/** submission queue ring fields */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+
+	/** tail of submission entries prepared but not yet submitted */
+	unsigned sqe_tail;
+
+	/** submission queue entries */
+	struct io_uring_sqe *sqes;
+
+	/** completion queue ring fields */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/** mapped regions */
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+};
+
+/**
+ * Initialize an io_uring instance.
+ *
+ * @param ring the ring
+ * @param entries the number of submission queue entries
+ * @return 0 if successful, -1 with errno set if error
+ */
+int uring_init(struct uring *ring, unsigned entries);
+
+/**
+ * Release an io_uring instance.
+ *
+ * @param ring the ring
+ */
+void uring_exit(struct uring *ring);
+
+/**
+ * Get the next free submission queue entry.
+ *
+ * @param ring the ring
+ * @return a zeroed entry or NULL if submission queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ * Submit prepared entries, and optionally wait for completions.
+ *
+ * @param ring the ring
+ * @param wait_nr number of completions to wait for
+ * @return number of entries submitted, -1 with errno set if error
+ */
+int uring_submit(struct uring *ring, unsigned wait_nr);
+
+/**
+ * Get the next completion queue entry without waiting.
+ *
+ * @param ring the ring
+ * @return the entry or NULL if none are available
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+/**
+ * Mark the entry returned by uring_peek_cqe() as consumed.
+ *
+ * @param ring the ring
+ */
+void uring_cqe_seen(struct uring *ring);
+
+/**
+ * Determine whether the io_uring backend is usable on this system:
+ * rings can be created, and support the operations of the event
+ * loop. Also records whether multishot accept and the file
+ * operations are supported. Call before starting other threads.
+ *
+ * @return true if the io_uring backend is usable
+ */
+bool uring_available(void);
+
+/**
+ * Determine whether the kernel supports multishot accept, as
+ * found by uring_available().
+ *
+ * @return true if multishot accept is supported
+ */
+bool uring_multishot_accept(void);
+
+/**
+ * Get the status of a file using the calling thread's ring.
+ * Fails with ENOSYS if the kernel cannot stat on a ring.
+ *
+ * @param path the file path
+ * @param sb the stat struct (mode, size, and times are set)
+ * @return 0 if successful, or -1 with errno set if error
+ */
+int uring_stat(const char *path, struct stat *sb);
+
+/**
+ * Get the status of a file and open it for reading, using
+ * a single submission on the calling thread's ring. Fails
+ * with ENOSYS if the kernel cannot stat and open on a ring.
+ *
+ * @param path the file path
+ * @param sb the stat struct (mode, size, and times are set)
+ * @return the open file descriptor, or -1 with errno set if error
+ */
+int uring_open_stat(const char *path, struct stat *sb);
+
+#endif /* URING_H_ */
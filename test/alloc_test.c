@@ -0,0 +1,252 @@
+/*
+ * alloc_test.c
+ *
+ * Tests that serving requests on a persistent connection does not
+ * allocate from the heap once the connection is warmed up. The
+ * test is linked with -Wl,--wrap for the allocation functions, so
+ * every call to them from the server code is counted.
+ *
+ *  @since 2020-04-22
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "connection.h"
+#include "http_request.h"
+#include "http_server.h"
+#include "time_util.h"
+
+/** http server configuration */
+struct http_server_conf server;
+
+/** number of allocation calls */
+static unsigned long nallocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+/**
+ * Count a call to malloc().
+ *
+ * @param size the number of bytes
+ * @return the allocated bytes
+ */
+void *__wrap_malloc(size_t size) {
+	__atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+/**
+ * Count a call to calloc().
+ *
+ * @param n the number of elements
+ * @param size the size of an element
+ * @return the allocated bytes
+ */
+void *__wrap_calloc(size_t n, size_t size) {
+	__atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(n, size);
+}
+
+/**
+ * Count a call to realloc().
+ *
+ * @param p the bytes to reallocate
+ * @param size the new number of bytes
+ * @return the reallocated bytes
+ */
+void *__wrap_realloc(void *p, size_t size) {
+	__atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(p, size);
+}
+
+/**
+ * Count a call to strdup().
+ *
+ * @param s the string to copy
+ * @return the copy
+ */
+char *__wrap_strdup(const char *s) {
+	__atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+	return __real_strdup(s);
+}
+
+/**
+ * Count a call to strndup().
+ *
+ * @param s the string to copy
+ * @param n the maximum number of bytes to copy
+ * @return the copy
+ */
+char *__wrap_strndup(const char *s, size_t n) {
+	__atomic_add_fetch(&nallocs, 1, __ATOMIC_RELAXED);
+	return __real_strndup(s, n);
+}
+
+/** requests served in each round */
+static const char *requests[] = {
+	"GET /index.html HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n",
+	"HEAD /index.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: alloc_test\r\n\r\n",
+	"GET /big.bin HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n",
+	"GET /missing.html HTTP/1.1\r\nHost: localhost\r\n\r\n",
+	"GET /index.html?a=1&b=2 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+};
+
+/** number of requests in each round */
+#define NREQUESTS (sizeof(requests) / sizeof(requests[0]))
+
+/**
+ * Read and discard responses from the server until it closes.
+ *
+ * @param arg pointer to the client socket
+ * @return NULL
+ */
+static void *drain_responses(void *arg) {
+	int fd = *(int *)arg;
+	char buf[65536];
+	while (read(fd, buf, sizeof(buf)) > 0) {
+	}
+	return NULL;
+}
+
+/**
+ * Write a file of a given size into the content directory.
+ *
+ * @param name the file name
+ * @param size the number of bytes
+ * @return true if the file was written
+ */
+static bool make_file(const char *name, size_t size) {
+	char path[MAXBUF];
+	snprintf(path, sizeof(path), "%s/%s", server.content_base, name);
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < size; i++) {
+		fputc('a' + (int)(i % 26), f);
+	}
+	return fclose(f) == 0;
+}
+
+/**
+ * Connect a client socket to a server socket over loopback TCP.
+ *
+ * @param client_fd the client socket
+ * @param server_fd the non-blocking server socket
+ * @return true if the sockets are connected
+ */
+static bool connect_loopback(int *client_fd, int *server_fd) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addrlen = sizeof(addr);
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if ((listen_fd < 0) || (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+			|| (listen(listen_fd, 1) != 0)
+			|| (getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen) != 0)) {
+		return false;
+	}
+	*client_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if ((*client_fd < 0) || (connect(*client_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+		return false;
+	}
+	*server_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+	close(listen_fd);
+	int on = 1;
+	return (*server_fd >= 0)
+			&& (setsockopt(*server_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == 0);
+}
+
+/**
+ * Send rounds of requests on a connection and serve them.
+ *
+ * @param conn the connection
+ * @param client_fd the client socket
+ * @param nrounds the number of rounds of requests
+ * @return true if every request was served
+ */
+static bool serve_rounds(struct connection *conn, int client_fd, int nrounds) {
+	for (int round = 0; round < nrounds; round++) {
+		for (size_t i = 0; i < NREQUESTS; i++) {
+			size_t len = strlen(requests[i]);
+			if (write(client_fd, requests[i], len) != (ssize_t)len) {
+				return false;
+			}
+			conn->request_start = monotonicTimeNanos() / 1000000;
+			if (!process_request(conn) || (conn_flush(conn) != 0)) {
+				fprintf(stderr, "request not served: %s", requests[i]);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Serve requests on a warmed-up connection, and check that
+ * they make no allocation calls.
+ *
+ * @return 0 if no allocation calls were made
+ */
+int main(void) {
+	char content_base[] = "/tmp/alloc_test.XXXXXX";
+	server.content_base = mkdtemp(content_base);
+	server.server_name = "alloc_test";
+	server.server_protocol = "HTTP/1.1";
+	server.keep_alive_max = 1000000;
+	server.keep_alive_timeout = 5;
+	server.header_timeout = 5;
+	server.body_timeout = 5;
+	server.request_timeout = 5;
+	if ((server.content_base == NULL) || !make_file("index.html", 2000)
+			|| !make_file("big.bin", 200000)) {
+		perror("content");
+		return 1;
+	}
+
+	int client_fd, server_fd;
+	if (!connect_loopback(&client_fd, &server_fd)) {
+		perror("connect");
+		return 1;
+	}
+	pthread_t reader;
+	pthread_create(&reader, NULL, drain_responses, &client_fd);
+
+	struct connection *conn = conn_new(server_fd, NULL);
+	conn_set_current(conn);
+
+	// first requests size the connection buffers and caches
+	bool served = serve_rounds(conn, client_fd, 10);
+	unsigned long warm = __atomic_load_n(&nallocs, __ATOMIC_RELAXED);
+	served = served && serve_rounds(conn, client_fd, 1000);
+	unsigned long steady = __atomic_load_n(&nallocs, __ATOMIC_RELAXED) - warm;
+
+	conn_set_current(NULL);
+	conn_delete(conn);
+	shutdown(client_fd, SHUT_WR);
+	pthread_join(reader, NULL);
+	close(client_fd);
+
+	char path[MAXBUF];
+	snprintf(path, sizeof(path), "%s/index.html", content_base);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/big.bin", content_base);
+	unlink(path);
+	rmdir(content_base);
+
+	printf("%lu allocations warming up, %lu for %lu requests\n",
+			warm, steady, 1000 * NREQUESTS);
+	return (served && (steady == 0)) ? 0 : 1;
+}
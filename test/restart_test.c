@@ -0,0 +1,192 @@
+/*
+ * restart_test.c
+ *
+ * Tests that a server started with a relative binary and
+ * configuration path hands its listener to a new server on
+ * SIGUSR2, although it has changed to its root directory.
+ *
+ *  @since 2020-04-22
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/** test directory, with the binary, configuration and content */
+static char dir[] = "/tmp/restart_test.XXXXXX";
+
+/**
+ * Write a file in the test directory.
+ *
+ * @param name the file name relative to the test directory
+ * @param text the contents of the file
+ * @return true if the file was written
+ */
+static bool write_file(const char *name, const char *text) {
+	char path[MAXPATHLEN];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		return false;
+	}
+	fputs(text, f);
+	return fclose(f) == 0;
+}
+
+/**
+ * Find a loopback port that is not in use, in the range of
+ * ports that the server accepts.
+ *
+ * @return the port, or 0 if none
+ */
+static int free_port(void) {
+	for (int i = 0; i < 100; i++) {
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+			.sin_port = htons(20000 + (getpid() + i * 97) % 20000)
+		};
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		bool bound = (fd >= 0) && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+		close(fd);
+		if (bound) {
+			return ntohs(addr.sin_port);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Determine whether the server answers a GET request with 200.
+ *
+ * @param port the server port
+ * @return true if the server answered 200
+ */
+static bool get_ok(int port) {
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+	};
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return false;
+	}
+	const char *request = "GET /index.html HTTP/1.0\r\n\r\n";
+	char response[16] = "";
+	bool ok = (write(fd, request, strlen(request)) == (ssize_t)strlen(request))
+			&& (read(fd, response, sizeof(response) - 1) > 0)
+			&& (strncmp(response, "HTTP/1.1 200", 12) == 0);
+	close(fd);
+	return ok;
+}
+
+/**
+ * Wait for the server to answer a GET request with 200.
+ *
+ * @param port the server port
+ * @return true if the server answered within 5 seconds
+ */
+static bool wait_get_ok(int port) {
+	struct timespec delay = { 0, 50000000 };
+	for (int i = 0; i < 100; i++) {
+		if (get_ok(port)) {
+			return true;
+		}
+		nanosleep(&delay, NULL);
+	}
+	return false;
+}
+
+/**
+ * Wait for a server process to exit.
+ *
+ * @param pid the process
+ * @return true if the process exited within 10 seconds
+ */
+static bool wait_exit(pid_t pid) {
+	struct timespec delay = { 0, 50000000 };
+	for (int i = 0; i < 200; i++) {
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			return true;
+		}
+		nanosleep(&delay, NULL);
+	}
+	return false;
+}
+
+/**
+ * Start the server from the test directory with relative paths,
+ * restart it, and check that the new server serves requests.
+ *
+ * @param argc the argument count
+ * @param argv the arguments; argv[1] is the server binary
+ * @return 0 if the new server took over
+ */
+int main(int argc, char *argv[argc]) {
+	int port = free_port();
+	if (argc != 2 || mkdtemp(dir) == NULL || port == 0) {
+		fprintf(stderr, "usage: %s server-binary\n", argv[0]);
+		return 1;
+	}
+	char path[MAXPATHLEN];
+	char conf[512];
+	snprintf(conf, sizeof(conf),
+			"Port=%d\nServerHost=localhost\nServerName=restart_test\n"
+			"ServerProtocol=HTTP/1.1\nServerRoot=../www\nContentBase=content\nThreads=2\n", port);
+	bool ready = true;
+	const char *dirs[] = { "build", "conf", "www", "www/content" };
+	for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+		ready = ready && (mkdir(path, 0777) == 0);
+	}
+	snprintf(path, sizeof(path), "%s/build/httpd", dir);
+	ready = ready && (symlink(argv[1], path) == 0)
+			&& write_file("conf/httpd.conf", conf)
+			&& write_file("www/content/index.html", "<html></html>\n");
+	if (!ready) {
+		perror(dir);
+		return 1;
+	}
+
+	// the server and the one it starts are in their own process group
+	pid_t pid = fork();
+	if (pid == 0) {
+		setpgid(0, 0);
+		if (chdir(dir) == 0) {
+			execl("./build/httpd", "./build/httpd", "conf/httpd.conf", (char *)NULL);
+		}
+		_exit(127);
+	}
+	setpgid(pid, pid);
+
+	bool started = wait_get_ok(port);
+	bool restarted = started && (kill(pid, SIGUSR2) == 0) && wait_exit(pid);
+	bool served = restarted && wait_get_ok(port);
+	kill(-pid, SIGTERM);
+	if (!restarted) {
+		waitpid(pid, NULL, 0);
+	}
+
+	const char *files[] = {
+		"www/content/index.html", "conf/httpd.conf", "build/httpd",
+		"www/content", "www", "conf", "build"
+	};
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+		remove(path);
+	}
+	rmdir(dir);
+
+	printf("started %s, restarted %s, new server %s\n", started ? "yes" : "no",
+			restarted ? "yes" : "no", served ? "serving" : "not serving");
+	return served ? 0 : 1;
+}
@@ -0,0 +1,346 @@
+/*
+ * simd_util_test.c
+ *
+ * Tests that the SSE4.2 and AVX2 string kernels give the same
+ * results as the scalar kernels, for every alignment of the
+ * bytes, lengths that end in a partial vector, and matches at
+ * every position. Also tests the percent decoding and HTML
+ * escaping built on them against expected results.
+ *
+ *  @since 2020-04-22
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "simd_util.h"
+
+/** largest misalignment of the bytes */
+#define MAX_OFFSET 32
+
+/** largest length of the bytes */
+#define MAX_LEN 160
+
+/** number of failed checks */
+static int failures = 0;
+
+/** buffers for the bytes and results */
+static char src[MAX_OFFSET + MAX_LEN + 1];
+static char src2[MAX_OFFSET + MAX_LEN + 1];
+static char dst[2][MAX_OFFSET + MAX_LEN + 1];
+static char esc[2][6 * MAX_LEN + 1];
+
+/**
+ * Report a result that differs from the scalar result.
+ *
+ * @param isa the instruction set
+ * @param kernel the name of the kernel
+ * @param off the offset of the bytes
+ * @param len the number of bytes
+ * @param pos the position of the match
+ */
+static void fail(const char *isa, const char *kernel, size_t off, size_t len, size_t pos) {
+	if (failures++ < 20) {
+		fprintf(stderr, "%s %s differs from scalar: offset %zu length %zu position %zu\n",
+				isa, kernel, off, len, pos);
+	}
+}
+
+/**
+ * Report a result that differs from the expected result.
+ *
+ * @param isa the instruction set
+ * @param kernel the name of the kernel
+ * @param input the input bytes
+ */
+static void fail_case(const char *isa, const char *kernel, const char *input) {
+	if (failures++ < 20) {
+		fprintf(stderr, "%s %s wrong for \"%s\"\n", isa, kernel, input);
+	}
+}
+
+/**
+ * Get the next value of a pseudo-random sequence.
+ *
+ * @return the next value
+ */
+static unsigned next_random(void) {
+	static unsigned seed = 12345;
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+/**
+ * Test str_find_any() with a set byte at every position.
+ *
+ * @param isa the instruction set
+ */
+static void test_find_any(const char *isa) {
+	static const char *sets[] = { "?&", "%", "\r\n", " \t\r\n:", "0123456789abcdef" };
+	for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+		const char *set = sets[i];
+		size_t nset = strlen(set);
+		for (size_t off = 0; off < MAX_OFFSET; off++) {
+			for (size_t len = 0; len <= MAX_LEN; len++) {
+				for (size_t pos = 0; pos <= len; pos++) {
+					memset(src, 'x', sizeof(src));
+					if (pos < len) {
+						src[off + pos] = set[pos % nset];
+					}
+					// a set byte just past the end must not be found
+					src[off + len] = set[0];
+					str_kernels_select("scalar");
+					size_t expected = str_find_any(src + off, len, set);
+					str_kernels_select(isa);
+					if (str_find_any(src + off, len, set) != expected) {
+						fail(isa, "str_find_any", off, len, pos);
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Test str_span_text() with a non-text byte at every position,
+ * and with random bytes.
+ *
+ * @param isa the instruction set
+ */
+static void test_span_text(const char *isa) {
+	static const unsigned char stops[] = { '\0', '\t', '\r', 0x1f, ' ', 0x7f };
+	static const unsigned char mins[] = { ' ', '!' };
+	for (size_t m = 0; m < sizeof(mins); m++) {
+		for (size_t off = 0; off < MAX_OFFSET; off++) {
+			for (size_t len = 0; len <= MAX_LEN; len++) {
+				for (size_t pos = 0; pos <= len; pos++) {
+					// text bytes, including those above 0x7f
+					for (size_t i = 0; i < sizeof(src); i++) {
+						src[i] = (char)('!' + (i * 7) % 0xde);
+					}
+					if (pos < len) {
+						src[off + pos] = (char)stops[pos % sizeof(stops)];
+					}
+					src[off + len] = '\0';
+					str_kernels_select("scalar");
+					size_t expected = str_span_text(src + off, len, mins[m]);
+					str_kernels_select(isa);
+					if (str_span_text(src + off, len, mins[m]) != expected) {
+						fail(isa, "str_span_text", off, len, pos);
+					}
+				}
+				for (size_t i = 0; i < sizeof(src); i++) {
+					src[i] = (char)next_random();
+				}
+				str_kernels_select("scalar");
+				size_t expected = str_span_text(src + off, len, mins[m]);
+				str_kernels_select(isa);
+				if (str_span_text(src + off, len, mins[m]) != expected) {
+					fail(isa, "str_span_text", off, len, len);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Test str_caseeq() with a difference at every position,
+ * including bytes that differ only in the case bit but are
+ * not letters.
+ *
+ * @param isa the instruction set
+ */
+static void test_caseeq(const char *isa) {
+	static const char diffs[][2] = { {'a', 'b'}, {'A', 'b'}, {'@', '`'}, {'[', '{'}, {'\0', ' '}, {'z', 'Z' + 1} };
+	size_t ndiffs = sizeof(diffs) / sizeof(diffs[0]);
+	for (size_t off = 0; off < MAX_OFFSET; off++) {
+		for (size_t len = 0; len <= MAX_LEN; len++) {
+			for (size_t pos = 0; pos <= len; pos++) {
+				// same bytes in different case
+				for (size_t i = 0; i < sizeof(src); i++) {
+					src[i] = (char)('A' + i % 26);
+					src2[i] = (char)('a' + i % 26);
+				}
+				if (pos < len) {
+					src[off + pos] = diffs[pos % ndiffs][0];
+					src2[off + pos] = diffs[pos % ndiffs][1];
+				}
+				// a difference just past the end must not be seen
+				src2[off + len] = '#';
+				str_kernels_select("scalar");
+				bool expected = str_caseeq(src + off, src2 + off, len);
+				str_kernels_select(isa);
+				if (str_caseeq(src + off, src2 + off, len) != expected) {
+					fail(isa, "str_caseeq", off, len, pos);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Test str_lower() with every byte value, both into another
+ * buffer and in place.
+ *
+ * @param isa the instruction set
+ */
+static void test_lower(const char *isa) {
+	for (size_t off = 0; off < MAX_OFFSET; off++) {
+		for (size_t len = 0; len <= MAX_LEN; len++) {
+			for (size_t i = 0; i < sizeof(src); i++) {
+				src[i] = (char)(i + off + len);
+			}
+			memset(dst, '#', sizeof(dst));
+			str_kernels_select("scalar");
+			str_lower(dst[0] + off, src + off, len);
+			str_kernels_select(isa);
+			str_lower(dst[1] + off, src + off, len);
+			if (memcmp(dst[0], dst[1], sizeof(dst[0])) != 0) {
+				fail(isa, "str_lower", off, len, len);
+			}
+
+			memcpy(dst[1], src, sizeof(src));
+			str_lower(dst[1] + off, dst[1] + off, len);
+			memcpy(dst[0] + off + len, src + off + len, sizeof(src) - off - len);
+			memcpy(dst[0], src, off);
+			if (memcmp(dst[0], dst[1], sizeof(dst[0])) != 0) {
+				fail(isa, "str_lower in place", off, len, len);
+			}
+		}
+	}
+}
+
+/**
+ * Test str_percent_decode() with malformed escapes, %00, mixed
+ * case hex digits, decoding in place, and an escape at every
+ * position, including those that straddle a vector.
+ *
+ * @param isa the instruction set
+ */
+static void test_percent_decode(const char *isa) {
+	static const struct {
+		const char *escaped;
+		const char *decoded;  // NULL if the escape is rejected
+	} cases[] = {
+		{ "", "" }, { "%4", NULL }, { "%", NULL }, { "abc%", NULL }, { "abc%4", NULL },
+		{ "%zz", NULL }, { "%4g", NULL }, { "%g4", NULL }, { "%00", NULL },
+		{ "/a%00.html", NULL }, { "%4a%4A%2f%2F", "JJ//" }, { "%25%2541", "%%41" },
+		{ "/a%20b/%7e%7E.html", "/a b/~~.html" }, { "%ff", "\xff" }
+	};
+	str_kernels_select(isa);
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		size_t len = strlen(cases[i].escaped);
+		ssize_t n = str_percent_decode(dst[0], cases[i].escaped, len);
+		// in place
+		memcpy(dst[1], cases[i].escaped, len);
+		ssize_t m = str_percent_decode(dst[1], dst[1], len);
+		bool ok = (cases[i].decoded == NULL)
+				? (n < 0) && (m < 0)
+				: (n == (ssize_t)strlen(cases[i].decoded)) && (m == n)
+					&& (memcmp(dst[0], cases[i].decoded, n) == 0)
+					&& (memcmp(dst[1], cases[i].decoded, n) == 0);
+		if (!ok) {
+			fail_case(isa, "str_percent_decode", cases[i].escaped);
+		}
+	}
+
+	for (size_t off = 0; off < MAX_OFFSET; off++) {
+		for (size_t len = 0; len <= MAX_LEN; len++) {
+			for (size_t pos = 0; pos <= len; pos++) {
+				// escape at pos, cut short if it does not fit
+				memset(src, 'x', sizeof(src));
+				memcpy(src + off + pos, "%3c", (len - pos < 3) ? len - pos : 3);
+				src[off + len] = '%';
+				memcpy(dst[1], src, sizeof(src));
+				str_kernels_select(isa);
+				ssize_t n = str_percent_decode(dst[0], src + off, len);
+				ssize_t m = str_percent_decode(dst[1] + off, dst[1] + off, len);
+				bool ok;
+				if (pos == len) {
+					ok = (n == (ssize_t)len) && (memcmp(dst[0], src + off, len) == 0);
+				} else if (len - pos < 3) {
+					ok = (n < 0);
+				} else {
+					ok = (n == (ssize_t)len - 2) && (memcmp(dst[0], src + off, pos) == 0)
+							&& (dst[0][pos] == '<')
+							&& (memcmp(dst[0] + pos + 1, src + off + pos + 3, len - pos - 3) == 0);
+				}
+				ok = ok && (m == n) && ((n < 0) || (memcmp(dst[1] + off, dst[0], n) == 0));
+				if (!ok) {
+					fail(isa, "str_percent_decode", off, len, pos);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Test str_html_escape() with each special character at every
+ * position, including those that straddle a vector.
+ *
+ * @param isa the instruction set
+ */
+static void test_html_escape(const char *isa) {
+	static const char specials[] = "&<>\"'";
+	static const char *refs[] = { "&amp;", "&lt;", "&gt;", "&quot;", "&#39;" };
+	for (size_t c = 0; c < sizeof(specials) - 1; c++) {
+		size_t nref = strlen(refs[c]);
+		for (size_t off = 0; off < MAX_OFFSET; off++) {
+			for (size_t len = 0; len <= MAX_LEN; len++) {
+				for (size_t pos = 0; pos <= len; pos++) {
+					memset(src, 'x', sizeof(src));
+					if (pos < len) {
+						src[off + pos] = specials[c];
+					}
+					// a special character just past the end must not be escaped
+					src[off + len] = specials[c];
+					size_t n_expected = len;
+					memcpy(esc[0], src + off, pos);
+					if (pos < len) {
+						memcpy(esc[0] + pos, refs[c], nref);
+						memcpy(esc[0] + pos + nref, src + off + pos + 1, len - pos - 1);
+						n_expected += nref - 1;
+					}
+					esc[0][n_expected] = '\0';
+					str_kernels_select(isa);
+					size_t n = str_html_escape(esc[1], src + off, len);
+					if ((n != n_expected) || (strcmp(esc[0], esc[1]) != 0)) {
+						fail(isa, "str_html_escape", off, len, pos);
+					}
+				}
+			}
+		}
+	}
+
+	// all five together
+	str_kernels_select(isa);
+	const char *input = "<a href=\"x?a=1&b='2'\">";
+	str_html_escape(esc[1], input, strlen(input));
+	if (strcmp(esc[1], "&lt;a href=&quot;x?a=1&amp;b=&#39;2&#39;&quot;&gt;") != 0) {
+		fail_case(isa, "str_html_escape", input);
+	}
+}
+
+/**
+ * Test the kernels for each instruction set that the cpu has,
+ * and the scalar kernels against expected results.
+ *
+ * @return 0 if the kernels give the expected results
+ */
+int main(void) {
+	static const char *isas[] = { "scalar", "sse4.2", "avx2" };
+	for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+		if (!str_kernels_select(isas[i])) {
+			printf("%s: not supported by this cpu\n", isas[i]);
+			continue;
+		}
+		int failed = failures;
+		test_find_any(isas[i]);
+		test_span_text(isas[i]);
+		test_caseeq(isas[i]);
+		test_lower(isas[i]);
+		test_percent_decode(isas[i]);
+		test_html_escape(isas[i]);
+		printf("%s: %s\n", isas[i], (failures == failed) ? "ok" : "FAILED");
+	}
+	return (failures == 0) ? 0 : 1;
+}